@@ -113,8 +113,9 @@ int main(int argc, char **argv)
     size_t n = atoll(argv[1]);
     int iterations = atoi(argv[2]);
 
-    double *in = (double *)ShrayMalloc(n, n * n * sizeof(double));
-    double *out = (double *)ShrayMalloc(n, n * n * sizeof(double));
+    /* The stencil reads one row beyond either end of our partition. */
+    double *in = (double *)ShrayMallocHalo(n, n * n * sizeof(double), 1);
+    double *out = (double *)ShrayMallocHalo(n, n * n * sizeof(double), 1);
 
     init(n, in);
     ShraySync(in);
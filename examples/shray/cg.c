@@ -97,37 +97,6 @@ static char *strcatalloc(const char *s)
     return res;
 }
 
-int read_sparse(char *name, void *array, size_t typewidth)
-{
-    FILE *stream = fopen(name, "r");
-    if (stream == NULL) {
-        perror("Opening file failed");
-        return 1;
-    }
-
-    size_t size = (ShrayEnd(array) - ShrayStart(array)) * typewidth;
-    long offset = ShrayStart(array) * typewidth;
-    if ((fseek(stream, offset, SEEK_SET)) != 0) {
-        perror("fseek failed");
-        return 1;
-    }
-
-    size_t read_bytes;
-    if ((read_bytes = fread(array + offset, 1, size, stream)) != size) {
-        fprintf(stderr, "We could not read in all items\n");
-        fprintf(stderr, "Read %zu / %zu bytes\n", read_bytes, size);
-        return 1;
-    }
-
-    int err;
-    if ((err = fclose(stream))) {
-        perror("Closing file failed");
-        return err;
-    }
-
-    return 0;
-}
-
 double gettime()
 {
     struct timeval tv_start;
@@ -291,29 +260,19 @@ c-------------------------------------------------------------------*/
     double *r = ShrayMalloc(NA, NA * sizeof(double));
 
 
+    /* Every node reads its part of the matrix straight into place. */
     char *name = strcatalloc("a.cg");
-    if (read_sparse(name, a, sizeof(double))) {
-        fprintf(stderr, "Reading %s went wrong\n", name);
-	    ShrayFinalize(1);
-    }
+    ShrayReadFile(a, name, 0);
     free(name);
 
     name = strcatalloc("colidx.cg");
-    if (read_sparse(name, colidx, sizeof(long))) {
-        fprintf(stderr, "Reading %s went wrong\n", name);
-    	ShrayFinalize(1);
-    }
+    ShrayReadFile(colidx, name, 0);
     free(name);
 
     name = strcatalloc("rowstr.cg");
-    if (read_sparse(name, rowstr, sizeof(long))) {
-        fprintf(stderr, "Reading %s went wrong\n", name);
-	    ShrayFinalize(1);
-    }
+    ShrayReadFile(rowstr, name, 0);
     free(name);
 
-    ShraySync(a, colidx, rowstr);
-
 /*--------------------------------------------------------------------
 c  set starting vector to (1, 1, .... 1)
 c-------------------------------------------------------------------*/
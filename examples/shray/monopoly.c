@@ -13,7 +13,7 @@ void init(double *a, size_t n)
 {
     /* sum_i a[i] = 1. */
 	for (size_t i = ShrayStart(a); i < ShrayEnd(a); ++i) {
-		a[i] = i / (n * (n + 1) / 2);
+		a[i] = (i + 1.0) / (n * (n + 1) / 2);
 	}
 }
 
@@ -94,6 +94,8 @@ int main(int argc, char **argv)
 	    printf("%lf\n", matrix->nnz_total * iterations * 2.0 / 1000000000 / duration);
 	}
 
+	ShrayReport();
+
 	ShrayFree(out);
 	ShrayFree(vector);
 	csr_free(matrix);
@@ -134,9 +134,10 @@ int main(int argc, char **argv)
     }
     int iterations = atoi(argv[2]);
 
-    Point *positions = (Point *)ShrayMalloc(n, n * sizeof(Point));
+    /* Every node reads all positions and masses each step. */
+    Point *positions = (Point *)ShrayMallocReplicated(n, n * sizeof(Point));
     Point *velocities = (Point *)ShrayMalloc(n, n * sizeof(Point));
-    double *masses = (double *)ShrayMalloc(n, n * sizeof(double));
+    double *masses = (double *)ShrayMallocReplicated(n, n * sizeof(double));
     Point *accel = (Point *)ShrayMalloc(n, n * sizeof(Point));
 
     init(positions);
@@ -0,0 +1,11 @@
+#!/bin/sh
+
+NODES=2
+while [ $NODES -le 8 ]
+do
+    sed "s/NODES/$NODES/g" delta.sh.template > delta_"$NODES".sh
+    sbatch delta_"$NODES".sh
+    rm delta_"$NODES".sh
+
+    NODES=$(( 2 * NODES ))
+done
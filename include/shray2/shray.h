@@ -11,12 +11,50 @@ extern "C" {
 
 extern bool ShrayOutput;
 
+/* Element types and operations of ShrayAccumulate. */
+typedef enum { SHRAY_FLOAT, SHRAY_DOUBLE, SHRAY_INT64 } ShrayType;
+typedef enum { SHRAY_SUM, SHRAY_MIN, SHRAY_MAX } ShrayOp;
+
 /* Debug declarations */
 void ShrayInit_debug(int *argc, char ***argv);
 void *ShrayMalloc_debug(size_t firstDimension, size_t totalSize);
+void *ShrayMallocReplicated_debug(size_t firstDimension, size_t totalSize);
+void *ShrayMallocFile_debug(size_t firstDimension, size_t totalSize,
+        const char *directory);
+void *ShrayMallocStale_debug(size_t firstDimension, size_t totalSize,
+        unsigned int maxStaleness);
+void *ShrayMallocMultiWriter_debug(size_t firstDimension, size_t totalSize);
+void *ShrayMallocSplit_debug(size_t firstDimension, size_t totalSize,
+        const size_t *splitPoints);
+void *ShrayMallocAligned_debug(size_t firstDimension, size_t totalSize);
+void *ShrayMallocHalo_debug(size_t firstDimension, size_t totalSize,
+        size_t haloRows);
+void *ShrayMallocCyclic_debug(size_t firstDimension, size_t totalSize,
+        size_t blockRows);
+void *ShrayMalloc2D_debug(size_t rows, size_t columns, size_t elementSize,
+        unsigned int gridRows, unsigned int gridCols);
 __attribute__((pure)) size_t ShrayStart_debug(void *array);
 __attribute__((pure)) size_t ShrayEnd_debug(void *array);
+bool ShrayLocalBlock_debug(void *array, size_t k, size_t *start, size_t *end);
+void ShrayTile_debug(void *array, size_t *rowStart, size_t *rowEnd,
+        size_t *columnStart, size_t *columnEnd);
 void ShraySync_debug(void *unused, ...);
+void ShraySyncRange_debug(void *array, size_t firstIndexStart,
+        size_t firstIndexEnd);
+void ShrayFetchAll_debug(void *array);
+void ShrayRedistribute_debug(void *destination, void *source);
+void ShrayCheckpoint_debug(void *array, const char *path);
+void *ShrayRestore_debug(const char *path);
+void ShrayReadFile_debug(void *array, const char *path, size_t offset);
+void ShrayWriteFile_debug(void *array, const char *path, size_t offset);
+void ShrayStore_debug(void *array, const char *name);
+void *ShrayAttach_debug(const char *name);
+void ShrayUnstore_debug(const char *name);
+void ShrayAcceptUpdates_debug(void *array);
+void ShrayAccumulate_debug(void *array, size_t index, const void *values,
+        size_t n, ShrayType type, ShrayOp op);
+void ShrayPut_debug(void *array, size_t offset, const void *source,
+        size_t size);
 void ShrayFree_debug(void *address);
 void ShrayReport_debug(void);
 __attribute__((pure)) unsigned int ShrayRank_debug(void);
@@ -29,9 +67,43 @@ void ShrayUncommit_debug(void *address, size_t size);
 /* Profile declarations */
 void ShrayInit_profile(int *argc, char ***argv);
 void *ShrayMalloc_profile(size_t firstDimension, size_t totalSize);
+void *ShrayMallocReplicated_profile(size_t firstDimension, size_t totalSize);
+void *ShrayMallocFile_profile(size_t firstDimension, size_t totalSize,
+        const char *directory);
+void *ShrayMallocStale_profile(size_t firstDimension, size_t totalSize,
+        unsigned int maxStaleness);
+void *ShrayMallocMultiWriter_profile(size_t firstDimension, size_t totalSize);
+void *ShrayMallocSplit_profile(size_t firstDimension, size_t totalSize,
+        const size_t *splitPoints);
+void *ShrayMallocAligned_profile(size_t firstDimension, size_t totalSize);
+void *ShrayMallocHalo_profile(size_t firstDimension, size_t totalSize,
+        size_t haloRows);
+void *ShrayMallocCyclic_profile(size_t firstDimension, size_t totalSize,
+        size_t blockRows);
+void *ShrayMalloc2D_profile(size_t rows, size_t columns, size_t elementSize,
+        unsigned int gridRows, unsigned int gridCols);
 __attribute__((pure)) size_t ShrayStart_profile(void *array);
 __attribute__((pure)) size_t ShrayEnd_profile(void *array);
+bool ShrayLocalBlock_profile(void *array, size_t k, size_t *start, size_t *end);
+void ShrayTile_profile(void *array, size_t *rowStart, size_t *rowEnd,
+        size_t *columnStart, size_t *columnEnd);
 void ShraySync_profile(void *unused, ...);
+void ShraySyncRange_profile(void *array, size_t firstIndexStart,
+        size_t firstIndexEnd);
+void ShrayFetchAll_profile(void *array);
+void ShrayRedistribute_profile(void *destination, void *source);
+void ShrayCheckpoint_profile(void *array, const char *path);
+void *ShrayRestore_profile(const char *path);
+void ShrayReadFile_profile(void *array, const char *path, size_t offset);
+void ShrayWriteFile_profile(void *array, const char *path, size_t offset);
+void ShrayStore_profile(void *array, const char *name);
+void *ShrayAttach_profile(const char *name);
+void ShrayUnstore_profile(const char *name);
+void ShrayAcceptUpdates_profile(void *array);
+void ShrayAccumulate_profile(void *array, size_t index, const void *values,
+        size_t n, ShrayType type, ShrayOp op);
+void ShrayPut_profile(void *array, size_t offset, const void *source,
+        size_t size);
 void ShrayFree_profile(void *address);
 void ShrayReport_profile(void);
 __attribute__((pure)) unsigned int ShrayRank_profile(void);
@@ -44,9 +116,43 @@ void ShrayUncommit_profile(void *address, size_t size);
 /* Normal declarations */
 void ShrayInit_normal(int *argc, char ***argv);
 void *ShrayMalloc_normal(size_t firstDimension, size_t totalSize);
+void *ShrayMallocReplicated_normal(size_t firstDimension, size_t totalSize);
+void *ShrayMallocFile_normal(size_t firstDimension, size_t totalSize,
+        const char *directory);
+void *ShrayMallocStale_normal(size_t firstDimension, size_t totalSize,
+        unsigned int maxStaleness);
+void *ShrayMallocMultiWriter_normal(size_t firstDimension, size_t totalSize);
+void *ShrayMallocSplit_normal(size_t firstDimension, size_t totalSize,
+        const size_t *splitPoints);
+void *ShrayMallocAligned_normal(size_t firstDimension, size_t totalSize);
+void *ShrayMallocHalo_normal(size_t firstDimension, size_t totalSize,
+        size_t haloRows);
+void *ShrayMallocCyclic_normal(size_t firstDimension, size_t totalSize,
+        size_t blockRows);
+void *ShrayMalloc2D_normal(size_t rows, size_t columns, size_t elementSize,
+        unsigned int gridRows, unsigned int gridCols);
 __attribute__((pure)) size_t ShrayStart_normal(void *array);
 __attribute__((pure)) size_t ShrayEnd_normal(void *array);
+bool ShrayLocalBlock_normal(void *array, size_t k, size_t *start, size_t *end);
+void ShrayTile_normal(void *array, size_t *rowStart, size_t *rowEnd,
+        size_t *columnStart, size_t *columnEnd);
 void ShraySync_normal(void *unused, ...);
+void ShraySyncRange_normal(void *array, size_t firstIndexStart,
+        size_t firstIndexEnd);
+void ShrayFetchAll_normal(void *array);
+void ShrayRedistribute_normal(void *destination, void *source);
+void ShrayCheckpoint_normal(void *array, const char *path);
+void *ShrayRestore_normal(const char *path);
+void ShrayReadFile_normal(void *array, const char *path, size_t offset);
+void ShrayWriteFile_normal(void *array, const char *path, size_t offset);
+void ShrayStore_normal(void *array, const char *name);
+void *ShrayAttach_normal(const char *name);
+void ShrayUnstore_normal(const char *name);
+void ShrayAcceptUpdates_normal(void *array);
+void ShrayAccumulate_normal(void *array, size_t index, const void *values,
+        size_t n, ShrayType type, ShrayOp op);
+void ShrayPut_normal(void *array, size_t offset, const void *source,
+        size_t size);
 void ShrayFree_normal(void *address);
 void ShrayReport_normal(void);
 __attribute__((pure)) unsigned int ShrayRank_normal(void);
@@ -60,9 +166,33 @@ void ShrayUncommit_normal(void *address, size_t size);
 
 #define ShrayInit(argc, argv) ShrayInit_debug(argc, argv)
 #define ShrayMalloc(firstDimension, totalSize) ShrayMalloc_debug(firstDimension, totalSize)
+#define ShrayMallocReplicated(firstDimension, totalSize) ShrayMallocReplicated_debug(firstDimension, totalSize)
+#define ShrayMallocFile(firstDimension, totalSize, directory) ShrayMallocFile_debug(firstDimension, totalSize, directory)
+#define ShrayMallocStale(firstDimension, totalSize, maxStaleness) ShrayMallocStale_debug(firstDimension, totalSize, maxStaleness)
+#define ShrayMallocMultiWriter(firstDimension, totalSize) ShrayMallocMultiWriter_debug(firstDimension, totalSize)
+#define ShrayMallocSplit(firstDimension, totalSize, splitPoints) ShrayMallocSplit_debug(firstDimension, totalSize, splitPoints)
+#define ShrayMallocAligned(firstDimension, totalSize) ShrayMallocAligned_debug(firstDimension, totalSize)
+#define ShrayMallocHalo(firstDimension, totalSize, haloRows) ShrayMallocHalo_debug(firstDimension, totalSize, haloRows)
+#define ShrayMallocCyclic(firstDimension, totalSize, blockRows) ShrayMallocCyclic_debug(firstDimension, totalSize, blockRows)
+#define ShrayMalloc2D(rows, columns, elementSize, gridRows, gridCols) ShrayMalloc2D_debug(rows, columns, elementSize, gridRows, gridCols)
 #define ShrayStart(array) ShrayStart_debug(array)
 #define ShrayEnd(array) ShrayEnd_debug(array)
+#define ShrayLocalBlock(array, k, start, end) ShrayLocalBlock_debug(array, k, start, end)
+#define ShrayTile(array, rowStart, rowEnd, columnStart, columnEnd) ShrayTile_debug(array, rowStart, rowEnd, columnStart, columnEnd)
 #define ShraySync(...) ShraySync_debug(NULL, __VA_ARGS__, NULL)
+#define ShraySyncRange(array, firstIndexStart, firstIndexEnd) ShraySyncRange_debug(array, firstIndexStart, firstIndexEnd)
+#define ShrayFetchAll(array) ShrayFetchAll_debug(array)
+#define ShrayRedistribute(destination, source) ShrayRedistribute_debug(destination, source)
+#define ShrayCheckpoint(array, path) ShrayCheckpoint_debug(array, path)
+#define ShrayRestore(path) ShrayRestore_debug(path)
+#define ShrayReadFile(array, path, offset) ShrayReadFile_debug(array, path, offset)
+#define ShrayWriteFile(array, path, offset) ShrayWriteFile_debug(array, path, offset)
+#define ShrayStore(array, name) ShrayStore_debug(array, name)
+#define ShrayAttach(name) ShrayAttach_debug(name)
+#define ShrayUnstore(name) ShrayUnstore_debug(name)
+#define ShrayAcceptUpdates(array) ShrayAcceptUpdates_debug(array)
+#define ShrayAccumulate(array, index, values, n, type, op) ShrayAccumulate_debug(array, index, values, n, type, op)
+#define ShrayPut(array, offset, source, size) ShrayPut_debug(array, offset, source, size)
 #define ShrayFree(address) ShrayFree_debug(address)
 #define ShrayReport() ShrayReport_debug()
 #define ShrayRank() ShrayRank_debug()
@@ -77,9 +207,33 @@ void ShrayUncommit_normal(void *address, size_t size);
 
 #define ShrayInit(argc, argv) ShrayInit_profile(argc, argv)
 #define ShrayMalloc(firstDimension, totalSize) ShrayMalloc_profile(firstDimension, totalSize)
+#define ShrayMallocReplicated(firstDimension, totalSize) ShrayMallocReplicated_profile(firstDimension, totalSize)
+#define ShrayMallocFile(firstDimension, totalSize, directory) ShrayMallocFile_profile(firstDimension, totalSize, directory)
+#define ShrayMallocStale(firstDimension, totalSize, maxStaleness) ShrayMallocStale_profile(firstDimension, totalSize, maxStaleness)
+#define ShrayMallocMultiWriter(firstDimension, totalSize) ShrayMallocMultiWriter_profile(firstDimension, totalSize)
+#define ShrayMallocSplit(firstDimension, totalSize, splitPoints) ShrayMallocSplit_profile(firstDimension, totalSize, splitPoints)
+#define ShrayMallocAligned(firstDimension, totalSize) ShrayMallocAligned_profile(firstDimension, totalSize)
+#define ShrayMallocHalo(firstDimension, totalSize, haloRows) ShrayMallocHalo_profile(firstDimension, totalSize, haloRows)
+#define ShrayMallocCyclic(firstDimension, totalSize, blockRows) ShrayMallocCyclic_profile(firstDimension, totalSize, blockRows)
+#define ShrayMalloc2D(rows, columns, elementSize, gridRows, gridCols) ShrayMalloc2D_profile(rows, columns, elementSize, gridRows, gridCols)
 #define ShrayStart(array) ShrayStart_profile(array)
 #define ShrayEnd(array) ShrayEnd_profile(array)
+#define ShrayLocalBlock(array, k, start, end) ShrayLocalBlock_profile(array, k, start, end)
+#define ShrayTile(array, rowStart, rowEnd, columnStart, columnEnd) ShrayTile_profile(array, rowStart, rowEnd, columnStart, columnEnd)
 #define ShraySync(...) ShraySync_profile(NULL, __VA_ARGS__, NULL)
+#define ShraySyncRange(array, firstIndexStart, firstIndexEnd) ShraySyncRange_profile(array, firstIndexStart, firstIndexEnd)
+#define ShrayFetchAll(array) ShrayFetchAll_profile(array)
+#define ShrayRedistribute(destination, source) ShrayRedistribute_profile(destination, source)
+#define ShrayCheckpoint(array, path) ShrayCheckpoint_profile(array, path)
+#define ShrayRestore(path) ShrayRestore_profile(path)
+#define ShrayReadFile(array, path, offset) ShrayReadFile_profile(array, path, offset)
+#define ShrayWriteFile(array, path, offset) ShrayWriteFile_profile(array, path, offset)
+#define ShrayStore(array, name) ShrayStore_profile(array, name)
+#define ShrayAttach(name) ShrayAttach_profile(name)
+#define ShrayUnstore(name) ShrayUnstore_profile(name)
+#define ShrayAcceptUpdates(array) ShrayAcceptUpdates_profile(array)
+#define ShrayAccumulate(array, index, values, n, type, op) ShrayAccumulate_profile(array, index, values, n, type, op)
+#define ShrayPut(array, offset, source, size) ShrayPut_profile(array, offset, source, size)
 #define ShrayFree(address) ShrayFree_profile(address)
 #define ShrayReport() ShrayReport_profile()
 #define ShrayRank() ShrayRank_profile()
@@ -92,9 +246,33 @@ void ShrayUncommit_normal(void *address, size_t size);
 #else
 #define ShrayInit(argc, argv) ShrayInit_normal(argc, argv)
 #define ShrayMalloc(firstDimension, totalSize) ShrayMalloc_normal(firstDimension, totalSize)
+#define ShrayMallocReplicated(firstDimension, totalSize) ShrayMallocReplicated_normal(firstDimension, totalSize)
+#define ShrayMallocFile(firstDimension, totalSize, directory) ShrayMallocFile_normal(firstDimension, totalSize, directory)
+#define ShrayMallocStale(firstDimension, totalSize, maxStaleness) ShrayMallocStale_normal(firstDimension, totalSize, maxStaleness)
+#define ShrayMallocMultiWriter(firstDimension, totalSize) ShrayMallocMultiWriter_normal(firstDimension, totalSize)
+#define ShrayMallocSplit(firstDimension, totalSize, splitPoints) ShrayMallocSplit_normal(firstDimension, totalSize, splitPoints)
+#define ShrayMallocAligned(firstDimension, totalSize) ShrayMallocAligned_normal(firstDimension, totalSize)
+#define ShrayMallocHalo(firstDimension, totalSize, haloRows) ShrayMallocHalo_normal(firstDimension, totalSize, haloRows)
+#define ShrayMallocCyclic(firstDimension, totalSize, blockRows) ShrayMallocCyclic_normal(firstDimension, totalSize, blockRows)
+#define ShrayMalloc2D(rows, columns, elementSize, gridRows, gridCols) ShrayMalloc2D_normal(rows, columns, elementSize, gridRows, gridCols)
 #define ShrayStart(array) ShrayStart_normal(array)
 #define ShrayEnd(array) ShrayEnd_normal(array)
+#define ShrayLocalBlock(array, k, start, end) ShrayLocalBlock_normal(array, k, start, end)
+#define ShrayTile(array, rowStart, rowEnd, columnStart, columnEnd) ShrayTile_normal(array, rowStart, rowEnd, columnStart, columnEnd)
 #define ShraySync(...) ShraySync_normal(NULL, __VA_ARGS__, NULL)
+#define ShraySyncRange(array, firstIndexStart, firstIndexEnd) ShraySyncRange_normal(array, firstIndexStart, firstIndexEnd)
+#define ShrayFetchAll(array) ShrayFetchAll_normal(array)
+#define ShrayRedistribute(destination, source) ShrayRedistribute_normal(destination, source)
+#define ShrayCheckpoint(array, path) ShrayCheckpoint_normal(array, path)
+#define ShrayRestore(path) ShrayRestore_normal(path)
+#define ShrayReadFile(array, path, offset) ShrayReadFile_normal(array, path, offset)
+#define ShrayWriteFile(array, path, offset) ShrayWriteFile_normal(array, path, offset)
+#define ShrayStore(array, name) ShrayStore_normal(array, name)
+#define ShrayAttach(name) ShrayAttach_normal(name)
+#define ShrayUnstore(name) ShrayUnstore_normal(name)
+#define ShrayAcceptUpdates(array) ShrayAcceptUpdates_normal(array)
+#define ShrayAccumulate(array, index, values, n, type, op) ShrayAccumulate_normal(array, index, values, n, type, op)
+#define ShrayPut(array, offset, source, size) ShrayPut_normal(array, offset, source, size)
 #define ShrayFree(address) ShrayFree_normal(address)
 #define ShrayReport() ShrayReport_normal()
 #define ShrayRank() ShrayRank_normal()
@@ -129,7 +307,87 @@ void ShrayUncommit_normal(void *address, size_t size);
  *
  * @fn void *ShrayMalloc(size_t firstDimension, size_t totalSize);
  *
- *   @brief       Allocates a distributed (multidimensional) array.
+ *   @brief       Allocates a distributed (multidimensional) array. Arrays of
+ *                at most a few pages are stored completely on every node, and
+ *                ShraySync gathers the parts of all nodes in one collective.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocReplicated(size_t firstDimension, size_t totalSize);
+ *
+ *   @brief       Allocates an array that every node stores completely. Nodes
+ *                write the same part as for ShrayMalloc, and ShraySync sends
+ *                it to all other nodes, so reads never fault. Meant for
+ *                arrays that every node reads completely between
+ *                ShraySyncs.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocFile(size_t firstDimension, size_t totalSize,
+ *                           const char *directory);
+ *
+ *   @brief       Allocates a distributed array like ShrayMalloc, but every
+ *                node maps its part from a file it creates in directory,
+ *                so the array may be larger than the memory of the nodes.
+ *                The operating system pages the parts in and out. The files
+ *                are removed when the array is freed or the program exits.
+ *                Meant for a directory on a fast local disk.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *   @param directory Directory for the files, on every node.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocStale(size_t firstDimension, size_t totalSize,
+ *                            unsigned int maxStaleness);
+ *
+ *   @brief       Allocates a distributed array like ShrayMalloc, but with
+ *                bounded-staleness reads. ShraySync does not invalidate
+ *                cached remote pages, instead a page is refetched on the
+ *                first access after it has become more than maxStaleness
+ *                ShraySyncs old. Meant for asynchronous iterative methods
+ *                that converge with stale values. maxStaleness = 0 gives
+ *                the semantics of ShrayMalloc.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *   @param maxStaleness Number of ShraySyncs a cached remote value may lag
+ *                behind.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocMultiWriter(size_t firstDimension, size_t totalSize);
+ *
+ *   @brief       Allocates a distributed array like ShrayMalloc, but every
+ *                node may write to every element, not only to those
+ *                between ShrayStart and ShrayEnd. The first write to a remote
+ *                page makes a copy (twin) of it, and ShraySync sends the
+ *                bytes that differ from the twin to their owners. Writes by
+ *                different nodes to the same element in between two
+ *                ShraySyncs are a data race.
  *
  *   @param firstDimension Extent of the first dimension of the allocated array.
  *   @param totalSize Total size of the array in bytes.
@@ -138,6 +396,119 @@ void ShrayUncommit_normal(void *address, size_t size);
  *
  ******************************************************************************/
 
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocSplit(size_t firstDimension, size_t totalSize,
+ *                            const size_t *splitPoints);
+ *
+ *   @brief       Allocates a distributed array like ShrayMalloc, but node r
+ *                owns rows [splitPoints[r], splitPoints[r + 1][ of the first
+ *                dimension. Useful when rows have a different cost, for
+ *                example to balance the nonzeros of a sparse matrix. If
+ *                splitPoints is NULL, every node gets floor(firstDimension /
+ *                ShraySize()) or ceil(firstDimension / ShraySize()) rows,
+ *                whereas ShrayMalloc gives every node but the last
+ *                ceil(firstDimension / ShraySize()) rows, which may leave the
+ *                last nodes with few or no rows.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *   @param splitPoints NULL, or ShraySize() + 1 non-decreasing row indices
+ *                from 0 to firstDimension. Has to be the same on all nodes.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocAligned(size_t firstDimension, size_t totalSize);
+ *
+ *   @brief       Allocates a distributed array like ShrayMallocSplit(
+ *                firstDimension, totalSize, NULL), but moves every split
+ *                point to the nearest row that starts a page. Nodes then do
+ *                not share pages, so ShraySync only has to invalidate and
+ *                there is no false sharing. The price is a worse balance, a
+ *                node may get up to half the least common multiple of the row
+ *                size and the page size more or fewer bytes. If there are
+ *                fewer rows than nodes times rows per least common multiple,
+ *                rounding would leave most nodes empty, so we warn and keep
+ *                the split of ShrayMallocSplit(firstDimension, totalSize,
+ *                NULL) instead.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocHalo(size_t firstDimension, size_t totalSize,
+ *                           size_t haloRows);
+ *
+ *   @brief       Allocates a distributed array like ShrayMalloc, where every
+ *                node also reads the haloRows rows beyond either end of its
+ *                partition, as in a stencil. At ShraySync the owners put
+ *                those rows into the memory of their neighbours, so reading
+ *                them never faults.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *   @param haloRows Number of rows beyond either end of ShrayStart, ShrayEnd
+ *                that we read.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMallocCyclic(size_t firstDimension, size_t totalSize,
+ *                             size_t blockRows);
+ *
+ *   @brief       Allocates a distributed array like ShrayMalloc, but
+ *                block-cyclically: the first dimension is cut into blocks of
+ *                blockRows rows, and block b is owned by node
+ *                b % ShraySize(). This keeps factorizations and triangular
+ *                solves load balanced as the active part of the matrix
+ *                shrinks. A node may own several blocks, so iterate over them
+ *                with ShrayLocalBlock instead of ShrayStart and ShrayEnd.
+ *
+ *   @param firstDimension Extent of the first dimension of the allocated array.
+ *   @param totalSize Total size of the array in bytes.
+ *   @param blockRows Number of rows per block, should be positive.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayMalloc2D(size_t rows, size_t columns, size_t elementSize,
+ *                         unsigned int gridRows, unsigned int gridCols);
+ *
+ *   @brief       Allocates a distributed rows x columns matrix, tiled over a
+ *                gridRows x gridCols process grid. Node pi * gridCols + pj
+ *                owns the tile of row block pi and column block pj, the
+ *                blocks differ at most one in size. Nodes then only fault in
+ *                the rows and columns they need, for example in matrix
+ *                multiplication and 2D stencils. Use ShrayTile instead of
+ *                ShrayStart and ShrayEnd.
+ *
+ *   @param rows  Extent of the first dimension of the matrix.
+ *   @param columns Extent of the second dimension of the matrix.
+ *   @param elementSize Size of an element in bytes.
+ *   @param gridRows Number of rows of the process grid.
+ *   @param gridCols Number of columns of the process grid, gridRows * gridCols
+ *                should be ShraySize(). If both are 0, the most square grid
+ *                is used.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
 /** <!--********************************************************************-->
  *
  * @fn size_t ShrayStart(void *array)
@@ -166,6 +537,44 @@ void ShrayUncommit_normal(void *address, size_t size);
  *
  ******************************************************************************/
 
+/** <!--********************************************************************-->
+ *
+ * @fn bool ShrayLocalBlock(void *array, size_t k, size_t *start, size_t *end)
+ *
+ *   @brief       Iterates over the blocks of the first dimension of a
+ *                distributed array we write to, in increasing order:
+ *
+ *                for (size_t k = 0; ShrayLocalBlock(A, k, &start, &end); k++)
+ *
+ *                Works for every distribution, for arrays that are not
+ *                block-cyclic there is a single block [ShrayStart(A),
+ *                ShrayEnd(A)[.
+ *
+ *   @param array Distributed array.
+ *   @param k     Index of the block among the blocks we own.
+ *   @param start Set to the first row of our k-th block.
+ *   @param end   Set to one past the last row of our k-th block.
+ *
+ *   @return false if we own fewer than k + 1 blocks, in which case start and
+ *           end are not set.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayTile(void *array, size_t *rowStart, size_t *rowEnd,
+ *                    size_t *columnStart, size_t *columnEnd)
+ *
+ *   @brief       Determines the tile of a matrix allocated by ShrayMalloc2D
+ *                we write to.
+ *
+ *   @param array Matrix allocated by ShrayMalloc2D.
+ *   @param rowStart, rowEnd Set such that we are allowed to write to (i, j)
+ *                for rowStart <= i < rowEnd and
+ *   @param columnStart, columnEnd columnStart <= j < columnEnd.
+ *
+ ******************************************************************************/
+
 /** <!--********************************************************************-->
  *
  * @fn void ShraySync(void *array, ...)
@@ -177,6 +586,234 @@ void ShrayUncommit_normal(void *address, size_t size);
  *
  ******************************************************************************/
 
+/** <!--********************************************************************-->
+ *
+ * @fn void ShraySyncRange(void *array, size_t firstIndexStart,
+ *                         size_t firstIndexEnd)
+ *
+ *   @brief         ShraySync restricted to the elements (i1, ..., id) with
+ *                  firstIndexStart <= i1 < firstIndexEnd. Only writes to those
+ *                  elements are published, and only cached copies of them are
+ *                  invalidated, the rest of the cache stays valid. Collective,
+ *                  all nodes have to pass the same range.
+ *
+ *   @param array   Array we have finished writing to.
+ *   @param firstIndexStart Start of the range of the first dimension.
+ *   @param firstIndexEnd End of the range of the first dimension.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayFetchAll(void *array)
+ *
+ *   @brief         Gives every node a copy of the whole array, for phases
+ *                  in which every node reads all of it. The parts are passed
+ *                  around a ring of nodes in P - 1 steps, instead of
+ *                  answering a page fault per page per node. The copies stay
+ *                  valid until the next ShraySync of array. Collective, has
+ *                  to be called after a ShraySync of array, and array may not
+ *                  be written until the next ShraySync. Not for multi-writer
+ *                  arrays.
+ *
+ *   @param array   Array to fetch.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayRedistribute(void *destination, void *source)
+ *
+ *   @brief       Copies source into destination, two distributed arrays of
+ *                the same size that may be distributed differently, for
+ *                example to rebalance after the load has shifted: allocate
+ *                the new distribution, redistribute, and free the old array.
+ *                Every node gets its part of destination directly from the
+ *                owners in source, without page faults. Has to be called by
+ *                all nodes, after a ShraySync of source, and acts as a
+ *                ShraySync of destination.
+ *
+ *   @param destination Distributed array to copy to.
+ *   @param source Distributed array to copy from.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayCheckpoint(void *array, const char *path)
+ *
+ *   @brief       Saves array to the file path, which all nodes must be able
+ *                to reach. Every node writes its own part, at its place in
+ *                the array, after a header that describes the array. The
+ *                file appears at path once all nodes are done, until then
+ *                path keeps the previous checkpoint. With
+ *                SHRAY_ASYNCCHECKPOINT=1 we return after copying our part,
+ *                and write it in the background, the file then appears at
+ *                the next ShrayCheckpoint, ShrayRestore or ShrayFinalize.
+ *                Has to be called by all nodes, after a ShraySync of array.
+ *
+ *   @param array Distributed array to save.
+ *   @param path File to save it to.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayRestore(const char *path)
+ *
+ *   @brief       Allocates the array saved in path by ShrayCheckpoint, with
+ *                the same distribution, and reads it. The number of nodes may
+ *                differ from when it was saved, the array is then split
+ *                evenly, or over the most square grid if it was tiled. Every
+ *                node reads its part straight from the file. Has to be
+ *                called by all nodes, and acts as a ShraySync of the array.
+ *
+ *   @param path File written by ShrayCheckpoint.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayReadFile(void *array, const char *path, size_t offset)
+ *
+ *   @brief       Reads array from the file path, which all nodes must be able
+ *                to reach, where it is stored in order from byte offset on.
+ *                Every node reads its own part straight into place, in large
+ *                requests that are split over its threads. Has to be called
+ *                by all nodes, and acts as a ShraySync of array.
+ *
+ *   @param array Distributed array to read into.
+ *   @param path File to read from.
+ *   @param offset Byte offset of the array in the file.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayWriteFile(void *array, const char *path, size_t offset)
+ *
+ *   @brief       Writes array to the file path from byte offset on, like
+ *                ShrayReadFile. The file is created if it does not exist,
+ *                the rest of it is left as it is. Has to be called by all
+ *                nodes, after a ShraySync of array.
+ *
+ *   @param array Distributed array to write.
+ *   @param path File to write to.
+ *   @param offset Byte offset of the array in the file.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayStore(void *array, const char *name)
+ *
+ *   @brief       Saves array under name in the store, so later jobs can
+ *                ShrayAttach it instead of reading and distributing it again.
+ *                Every node copies its own part to a file in the directory
+ *                SHRAY_STORE, /dev/shm by default, which lives on after the
+ *                job until ShrayUnstore. An array stored earlier under name
+ *                is replaced. Has to be called by all nodes, after a
+ *                ShraySync of array.
+ *
+ *   @param array Distributed array to store.
+ *   @param name Name in the store, without slashes.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void *ShrayAttach(const char *name)
+ *
+ *   @brief       Allocates the array stored under name by ShrayStore, with the
+ *                same distribution. Every node maps its part straight from
+ *                the store, so nothing is read or sent. The job needs as many
+ *                nodes on the same hosts as the one that stored it. Writes
+ *                to the array change it in the store as well, ShrayFree
+ *                leaves it there. Has to be called by all nodes, and acts as
+ *                a ShraySync of the array.
+ *
+ *   @param name Name in the store.
+ *
+ *   @return Pointer to the allocation.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayUnstore(const char *name)
+ *
+ *   @brief       Removes the array stored under name from the store. Jobs
+ *                that attached it keep their copy. Has to be called by all
+ *                nodes.
+ *
+ *   @param name Name in the store.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayAcceptUpdates(void *array)
+ *
+ *   @brief         Lets nodes ShrayAccumulate and ShrayPut into elements of
+ *                  array that they do not own. Every ShraySync of array then
+ *                  first waits until the owners applied them, which costs an
+ *                  extra barrier. Cached pages are not twinned, unlike those
+ *                  of ShrayMallocMultiWriter arrays, which accept remote
+ *                  updates already. Has to be called by all nodes.
+ *
+ *   @param array   Distributed array.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayAccumulate(void *array, size_t index, const void *values,
+ *                          size_t n, ShrayType type, ShrayOp op)
+ *
+ *   @brief         Does array[index + i] = op(array[index + i], values[i]) for
+ *                  0 <= i < n, where array and values are of element type
+ *                  type. Elements we own are updated immediately, the others
+ *                  are buffered and applied by their owner at the latest
+ *                  during the next ShraySync of array. Accumulating into
+ *                  elements we do not own requires ShrayAcceptUpdates(array),
+ *                  or array to be allocated by ShrayMallocMultiWriter.
+ *                  Accumulates are atomic with respect to each other, not
+ *                  with respect to plain writes.
+ *
+ *   @param array   Distributed array, interpreted as one-dimensional.
+ *   @param index   Index of the first element to update.
+ *   @param values  The n values to combine with the array.
+ *   @param n       Number of elements to update.
+ *   @param type    Element type, SHRAY_FLOAT, SHRAY_DOUBLE or SHRAY_INT64.
+ *   @param op      SHRAY_SUM, SHRAY_MIN or SHRAY_MAX.
+ *
+ ******************************************************************************/
+
+/** <!--********************************************************************-->
+ *
+ * @fn void ShrayPut(void *array, size_t offset, const void *source,
+ *                   size_t size)
+ *
+ *   @brief         Copies [source, source + size[ to bytes
+ *                  [offset, offset + size[ of array. The part we own is
+ *                  written immediately, the rest is buffered per owner,
+ *                  combining consecutive puts, and written by the owner at
+ *                  the latest during the next ShraySync of array. Putting
+ *                  into elements we do not own requires
+ *                  ShrayAcceptUpdates(array), or array to be allocated by
+ *                  ShrayMallocMultiWriter. Puts and accumulates to the same
+ *                  owner are applied in program order. No alignment is
+ *                  required.
+ *
+ *   @param array   Distributed array.
+ *   @param offset  Offset in bytes from the start of array.
+ *   @param source  Buffer to copy from.
+ *   @param size    Number of bytes to copy.
+ *
+ ******************************************************************************/
+
 /** <!--********************************************************************-->
  *
  * @fn void ShrayFree(void *array)
@@ -91,6 +91,25 @@ int BitmapCheck(Bitmap *bitmap, size_t index)
                 (0x8000000000000000u >> bit(index))) != (uint64_t)0);
 }
 
+size_t BitmapNextOne(Bitmap *bitmap, size_t start)
+{
+    if (start >= bitmap->size) return bitmap->size;
+
+    size_t n = integer(start);
+    size_t integers = roundUp(bitmap->size, 64);
+    /* Mask out the bits before start. */
+    uint64_t current = bitmap->bits[n] & (0xFFFFFFFFFFFFFFFFu >> bit(start));
+
+    while (current == 0) {
+        n++;
+        if (n == integers) return bitmap->size;
+        current = bitmap->bits[n];
+    }
+
+    size_t index = n * 64 + __builtin_clzll(current);
+    return (index < bitmap->size) ? index : bitmap->size;
+}
+
 /* Sets [start, end[ to zero. */
 void BitmapSetZeroes(Bitmap *bitmap, size_t start, size_t end)
 {
@@ -123,6 +142,32 @@ void BitmapSetZeroes(Bitmap *bitmap, size_t start, size_t end)
     }
 }
 
+void BitmapSetOnes(Bitmap *bitmap, size_t start, size_t end)
+{
+    int firstOnes = 64 - bit(start);
+    int lastOnes = 1 + bit(end - 1);
+    size_t startIndex = integer(start);
+    size_t endIndex = integer(end - 1);
+    /* Has ones at the bits we want to set to one. */
+    uint64_t firstOnesMask = (firstOnes == 64) ?
+        ~(uint64_t)0 : ~(0xFFFFFFFFFFFFFFFFu << firstOnes);
+    uint64_t lastOnesMask = (lastOnes == 64) ?
+        ~(uint64_t)0 : ~(0xFFFFFFFFFFFFFFFFu >> lastOnes);
+
+    if (startIndex == endIndex) {
+        bitmap->bits[startIndex] |= firstOnesMask & lastOnesMask;
+        return;
+    }
+
+    bitmap->bits[startIndex] |= firstOnesMask;
+
+    bitmap->bits[endIndex] |= lastOnesMask;
+
+    for (long i = startIndex + 1; i < (long)endIndex; i++) {
+        bitmap->bits[i] = 0xFFFFFFFFFFFFFFFFu;
+    }
+}
+
 void BitmapSetOne(Bitmap *bitmap, size_t index)
 {
     uint64_t mask = 0x8000000000000000u >> bit(index);
@@ -22,6 +22,9 @@ void BitmapFree(Bitmap *bitmap);
 /* Sets [start, end[ to zero. */
 void BitmapSetZeroes(Bitmap *bitmap, size_t start, size_t end);
 
+/* Sets [start, end[ to one. */
+void BitmapSetOnes(Bitmap *bitmap, size_t start, size_t end);
+
 /* Sets index'th bit to one. */
 void BitmapSetOne(Bitmap *bitmap, size_t index);
 
@@ -32,6 +35,10 @@ void BitmapReset(Bitmap *bitmap);
 /* Returns 1 iff the index'th bit of bitmap is 1. */
 int BitmapCheck(Bitmap *bitmap, size_t index);
 
+/* Returns the smallest index >= start whose bit is 1, or bitmap->size if there
+ * is no such index. */
+size_t BitmapNextOne(Bitmap *bitmap, size_t start);
+
 void BitmapPrint(Bitmap *bitmap);
 
 #endif
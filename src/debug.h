@@ -18,8 +18,14 @@
 #ifdef SHRAY_PROFILE
     #define BARRIERCOUNT Shray_BarrierCounter++;
     #define SEGFAULTCOUNT Shray_SegfaultCounter++;
+    #define FETCHCOUNT(bytes)                                                 \
+        __atomic_fetch_add(&Shray_FetchedBytes, bytes, __ATOMIC_RELAXED);
+    #define DELTASAVEDCOUNT(bytes)                                            \
+        __atomic_fetch_add(&Shray_DeltaSavedBytes, bytes, __ATOMIC_RELAXED);
 #else
     #define BARRIERCOUNT
     #define SEGFAULTCOUNT
+    #define FETCHCOUNT(bytes)
+    #define DELTASAVEDCOUNT(bytes)
     #define PREFETCHMISS
 #endif
@@ -38,7 +38,9 @@ void ringbuffer_add(ringbuffer_t *ring, void *alloc, void *start)
 	} else {
 		ring->end = (ring->end + 1) % ring->size;
 		if (ring->end == ring->start) {
+			/* We overwrite the front entry. */
 			ring->start = (ring->start + 1) % ring->size;
+			--ring->entries;
 		}
 	}
 
@@ -75,6 +77,34 @@ int ringbuffer_full(const ringbuffer_t *ring)
 	return ring->size == ring->entries;
 }
 
+void ringbuffer_filter(ringbuffer_t *ring,
+		int (*keep)(const cache_entry_t *entry, void *arg), void *arg)
+{
+	if (ringbuffer_empty(ring)) {
+		return;
+	}
+
+	size_t entries = ring->entries;
+	size_t from = ring->start;
+	size_t to = ring->start;
+	ring->entries = 0;
+
+	for (size_t i = 0; i < entries; i++) {
+		if (keep(&ring->data[from], arg)) {
+			ring->data[to] = ring->data[from];
+			to = (to + 1) % ring->size;
+			++ring->entries;
+		}
+		from = (from + 1) % ring->size;
+	}
+
+	if (ring->entries == 0) {
+		ringbuffer_reset(ring);
+	} else {
+		ring->end = (to + ring->size - 1) % ring->size;
+	}
+}
+
 void ringbuffer_reset(ringbuffer_t *ring)
 {
 	ring->start = NOENTRY;
@@ -35,7 +35,8 @@ ringbuffer_t *ringbuffer_alloc(size_t size);
 void ringbuffer_free(ringbuffer_t *ring);
 
 /**
- * Add a new entry to the ringbuffer.
+ * Add a new entry to the ringbuffer, overwriting the front entry if it is
+ * full.
  */
 void ringbuffer_add(ringbuffer_t *ring, void *alloc, void *start);
 
@@ -59,6 +60,13 @@ int ringbuffer_empty(const ringbuffer_t *ring);
  */
 int ringbuffer_full(const ringbuffer_t *ring);
 
+/**
+ * Remove the entries for which keep(entry, arg) returns 0, keeping the order
+ * of the others.
+ */
+void ringbuffer_filter(ringbuffer_t *ring,
+		int (*keep)(const cache_entry_t *entry, void *arg), void *arg);
+
 /**
  * Reset the ringbuffer, removing all entries.
  */
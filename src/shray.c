@@ -1,7 +1,8 @@
 /* Distribution: 1d it is a block distribution on the bytes, so
  * phi_s(k) = k + s * roundUp(n, p), in the higher dimensional case,
- * we distribute blockwise along the first dimension. See also the
- * definitions of Aw_r, Ar_r, Ap_r. */
+ * we distribute blockwise along the first dimension. Allocations can also be
+ * split irregularly, block-cyclically, or in 2d tiles. See also the
+ * definitions of Aw_b, Ar_b, Ap_b. */
 
 #include "shray.h"
 #include "bitmap.h"
@@ -13,6 +14,11 @@
 #include <pthread.h>
 #include <unistd.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <omp.h>
+#include <sys/syscall.h>
 
 /*****************************************************
  * Global variable declarations.
@@ -28,6 +34,8 @@ unsigned int Shray_rank;
 unsigned int Shray_size;
 size_t Shray_SegfaultCounter;
 size_t Shray_BarrierCounter;
+size_t Shray_FetchedBytes;
+size_t Shray_DeltaSavedBytes;
 size_t Shray_Pagesz;
 size_t Shray_CacheLineSize;
 double Shray_CacheAllocFactor;
@@ -39,8 +47,123 @@ bool ShrayOutput;
 #define HOSTNAME_LENGTH 256
 static char ShrayHost[HOSTNAME_LENGTH];
 
+/* Per rank its process id if it runs on our host, 0 otherwise, and whether
+ * any two ranks share a host, see findHostPeers. */
+static pid_t *hostPids;
+static bool hostSharing;
+/* Whether another rank runs on our host, the lowest rank on our host, which
+ * creates the host caches, and the number of ranks on our host. */
+static bool hostPeers;
+static unsigned int hostLeader;
+static unsigned int hostRanks;
+
+/* Placement of our partitions over the NUMA nodes of our host, see
+ * SHRAY_NUMA in ShrayInit. */
+typedef enum { NUMA_FIRST_TOUCH, NUMA_INTERLEAVE, NUMA_BIND } NumaPolicy;
+static NumaPolicy numaPolicy;
+/* Touch our partitions at allocation, see SHRAY_PREFAULT. */
+static bool prefault;
+/* Back our partitions by transparent huge pages, and cache lines that are a
+ * multiple of HUGE_PAGE_SIZE by huge pages, see SHRAY_HUGEPAGES. */
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+static bool hugePages;
+static bool hugeShadowPages;
+/* Owners record which parts of their pages change, so we refetch only those
+ * parts of a remote page we cached in the previous epoch, see SHRAY_DELTA. A
+ * page is compared in DELTA_SEGMENTS parts. */
+static bool deltaRefetch;
+#define DELTA_SEGMENTS 64
+/* We keep a copy of a cached page until this many epochs after we fetched
+ * it. */
+#define RETAIN_EPOCHS 2
+/* The NUMA nodes we may allocate on. */
+#define NUMA_MASK_WORDS 16
+static unsigned long numaNodes[NUMA_MASK_WORDS];
+
 static bool thread_lock;
 
+/* Allocations by ShrayMalloc of at most this many pages are replicated, see
+ * gatherReplicated. */
+#define REPLICATED_PAGES 4
+
+/* GASNet active message handler indices, clients may use 128-255. */
+#define HANDLER_UPDATE 128
+#define HANDLER_UPDATE_ACK 129
+#define HANDLER_RING 130
+
+/* Protects the application of remote updates to our partitions, which also
+ * happens in active message handlers, so it cannot be thread_lock. */
+static bool update_lock;
+
+/* Protects updateBuffers, updateFill and updateLast, so threads buffer their
+ * updates without taking thread_lock. Neither this lock nor update_lock is
+ * held while reading caller memory, as that may fault on a remote page. */
+static bool buffer_lock;
+
+/* ShrayAccumulate and ShrayPut copy caller memory to the stack in pieces of
+ * this many bytes before taking one of the update locks. */
+#define UPDATE_STAGE 4096
+
+/* Per node a buffer of UpdateRecords of gasnet_AMMaxMedium() bytes,
+ * allocated on first use, the number of bytes in use, and the offset of the
+ * last record (NO_RECORD if there is none). */
+static char **updateBuffers;
+static size_t *updateFill;
+static size_t *updateLast;
+#define NO_RECORD SIZE_MAX
+
+/* Value of UpdateRecord.op for ShrayPut. */
+#define RECORD_PUT 255
+
+/* Number of update messages that have not been acknowledged yet. */
+static size_t updatesInFlight;
+
+/* ringAllgather passes blocks on in pieces of this many bytes, so a node can
+ * forward the first piece of a block while it still receives the rest. */
+#define RING_CHUNK (256 * 1024)
+
+/* Number of ringAllgather pieces the previous node has put into us. */
+static size_t ringArrived;
+
+/* Per node the last boundary push that sent to it, so a part of a shared page
+ * is sent to every node once, see pushPagePart. */
+static size_t *pagePushes;
+static size_t pagePush;
+
+/* Checkpoint files start with CHECKPOINT_MAGIC, and the array starts at a
+ * multiple of CHECKPOINT_ALIGN bytes, see ShrayCheckpoint. */
+#define CHECKPOINT_MAGIC "SHRAYCKP"
+#define CHECKPOINT_VERSION 2
+#define CHECKPOINT_ALIGN 4096
+
+/* ShrayReadFile and ShrayWriteFile split our part of an array into requests
+ * of at most IO_CHUNK bytes, which our threads do in parallel. Requests skip
+ * the page cache with O_DIRECT where memory and file are IO_ALIGN aligned. */
+#define IO_CHUNK (4 * 1024 * 1024)
+#define IO_ALIGN 4096
+
+/* Directory of the arrays that outlive the job, see ShrayStore and
+ * SHRAY_STORE. */
+static const char *storeDirectory;
+
+/* Write checkpoints in the background, see SHRAY_ASYNCCHECKPOINT. */
+static bool asyncCheckpoints;
+
+/* The checkpoint we are writing, path is NULL if there is none. We write to
+ * partial, and move it to path once every node has written its part, see
+ * finishCheckpoint. In the background, writer writes the segments from a
+ * snapshot of our blocks. */
+static struct {
+    char *path;
+    char *partial;
+    int fd;
+    int directFd;
+    FileSegment *segments;
+    size_t numberOfSegments;
+    char *snapshot;
+    pthread_t writer;
+} checkpoint;
+
 /*****************************************************
  * Helper functions
  *****************************************************/
@@ -55,6 +178,16 @@ static inline size_t min(size_t x, size_t y)
     return x < y ? x : y;
 }
 
+static inline size_t gcd(size_t a, size_t b)
+{
+    while (b != 0) {
+        size_t r = a % b;
+        a = b;
+        b = r;
+    }
+    return a;
+}
+
 /* Returns ceil(a / b) */
 static inline uintptr_t roundUp(uintptr_t a, uintptr_t b)
 {
@@ -84,50 +217,219 @@ static uintptr_t roundDownPage(uintptr_t addr)
     return addr / Shray_Pagesz * Shray_Pagesz;
 }
 
-/* Aw_r := [startWrite(A, r), endWrite(A, r)[ is the part of A that rank r
- * should calculate, and that it writes to. (Aw_r)_r partitions A, Aw_r is not
- * page-aligned. */
-static inline uintptr_t startWrite(Allocation *alloc, unsigned int rank)
+/* An allocation is split into blocks of consecutive bytes, each owned by a
+ * single rank.
+ *  - Block and irregular distributions have one block of rows per rank, block
+ *    b is owned by rank b.
+ *  - Block-cyclic allocations have blocks of blockRows rows, block b is owned
+ *    by rank b % Shray_size.
+ *  - Tiled allocations (see ShrayMalloc2D) have gridCols blocks per row, block
+ *    i * gridCols + k is column block k of row i, and rank pi * gridCols + pj
+ *    owns column block pj of the rows of row block pi. */
+static inline bool isTiled(Allocation *alloc)
+{
+    return alloc->gridCols != 0;
+}
+
+/* First index of part p out of parts of a balanced split of n. */
+static inline size_t splitStart(size_t n, size_t parts, size_t p)
+{
+    return p * n / parts;
+}
+
+/* The last part p of a balanced split of n with splitStart(n, parts, p) <= i,
+ * so empty parts are skipped. */
+static inline size_t splitPart(size_t n, size_t parts, size_t i)
+{
+    return min(((i + 1) * parts - 1) / n, parts - 1);
+}
+
+static inline size_t numberOfBlocks(Allocation *alloc)
+{
+    if (isTiled(alloc)) {
+        return max(alloc->firstDimension * alloc->gridCols, 1);
+    }
+    return (alloc->blockRows == 0) ? Shray_size :
+        max(roundUp(alloc->firstDimension, alloc->blockRows), 1);
+}
+
+static inline unsigned int blockOwner(Allocation *alloc, size_t block)
+{
+    if (isTiled(alloc)) {
+        size_t row = block / alloc->gridCols;
+        return splitPart(alloc->firstDimension, alloc->gridRows, row) *
+            alloc->gridCols + block % alloc->gridCols;
+    }
+    return block % Shray_size;
+}
+
+/* First row of block, for allocations that are not tiled. */
+static inline size_t blockStart(Allocation *alloc, size_t block)
+{
+    return (alloc->blockRows == 0) ? alloc->splitPoints[block] :
+        min(block * alloc->blockRows, alloc->firstDimension);
+}
+
+/* Offset of the first byte of block. */
+static inline size_t blockOffset(Allocation *alloc, size_t block)
+{
+    if (isTiled(alloc)) {
+        size_t elementSize = alloc->bytesPerRow / alloc->columns;
+        return block / alloc->gridCols * alloc->bytesPerRow + elementSize *
+            splitStart(alloc->columns, alloc->gridCols,
+                    block % alloc->gridCols);
+    }
+    return blockStart(alloc, block) * alloc->bytesPerRow;
+}
+
+/* Aw_b := [startWrite(A, b), endWrite(A, b)[ is the part of A in block b,
+ * which its owner should calculate, and writes to. (Aw_b)_b partitions A,
+ * Aw_b is not page-aligned, and may be empty. */
+static inline uintptr_t startWrite(Allocation *alloc, size_t block)
 {
-    return alloc->location + rank * alloc->bytesPerBlock;
+    return alloc->location + blockOffset(alloc, block);
 }
 
-static inline uintptr_t endWrite(Allocation *alloc, unsigned int rank)
+static inline uintptr_t endWrite(Allocation *alloc, size_t block)
 {
-    return (rank == Shray_size - 1) ?
+    return (block == numberOfBlocks(alloc) - 1) ?
         alloc->location + alloc->size :
-        alloc->location + (rank + 1) * alloc->bytesPerBlock;
+        alloc->location + blockOffset(alloc, block + 1);
+}
+
+/* Bytes of the halo on either side of a block. */
+static inline size_t haloBytes(Allocation *alloc)
+{
+    return alloc->haloRows * alloc->bytesPerRow;
 }
 
-/* Ar_r := [startRead(A, r), endRead(A, r)[ is the part of A that is stored on
- * node r. (Ar_r)_r covers A, but is not a partition. Ar_r is the minimal
- * page-aligned superset of Aw_r. */
-static inline uintptr_t startRead(Allocation *alloc, unsigned int rank)
+/* Ar_b := [startRead(A, b), endRead(A, b)[ is the part of A that is stored on
+ * the owner of b for this block. (Ar_b)_b covers A, but is not a partition.
+ * Ar_b is the minimal page-aligned superset of Aw_b extended by the halo, or
+ * all of A if A is replicated. Both startRead and endRead are non-decreasing
+ * in b. */
+static inline uintptr_t startRead(Allocation *alloc, size_t block)
 {
-    return roundDownPage(alloc->location + rank * alloc->bytesPerBlock);
+    if (alloc->replicated) return alloc->location;
+
+    uintptr_t start = startWrite(alloc, block);
+    return roundDownPage(start - min(haloBytes(alloc), start - alloc->location));
 }
 
-static inline uintptr_t endRead(Allocation *alloc, unsigned int rank)
+static inline uintptr_t endRead(Allocation *alloc, size_t block)
 {
-    return (rank == Shray_size - 1) ?
-        roundUpPage(alloc->location + alloc->size) :
-        roundUpPage(alloc->location + (rank + 1) * alloc->bytesPerBlock);
+    if (alloc->replicated) return roundUpPage(alloc->location + alloc->size);
+
+    uintptr_t end = min(endWrite(alloc, block) + haloBytes(alloc),
+            alloc->location + alloc->size);
+    return roundUpPage(end);
 }
 
-/* Ap_r := [startPartition(A, r), endPartition(A, r)[ is a subset of Ar_r such
- * that (Ap_r)_r is a partitioning of \bigcup_r (Ar_r)_r (which is A + some
- * dummy entries at the last page of the allocation). Note, Ap_r may be
+/* Ap_b := [startPartition(A, b), endPartition(A, b)[ is a subset of Ar_b such
+ * that (Ap_b)_b is a partitioning of \bigcup_b (Ar_b)_b (which is A + some
+ * dummy entries at the last page of the allocation). Note, Ap_b may be
  * empty! */
-static inline uintptr_t startPartition(Allocation *alloc, unsigned int rank)
+static inline uintptr_t startPartition(Allocation *alloc, size_t block)
+{
+    return (block > 0 &&
+            endRead(alloc, block - 1) == startRead(alloc, block) + Shray_Pagesz) ?
+        startRead(alloc, block) + Shray_Pagesz :
+        startRead(alloc, block);
+}
+
+static inline uintptr_t endPartition(Allocation *alloc, size_t block)
+{
+    return endRead(alloc, block);
+}
+
+/* Returns the block b such that address is in Aw_b. This is the last block
+ * that starts at or before address, so empty blocks are skipped. */
+static inline size_t findBlock(Allocation *alloc, uintptr_t address)
+{
+    size_t offset = address - alloc->location;
+
+    if (isTiled(alloc)) {
+        /* Resolve (i, j) from the address. */
+        size_t i = offset / alloc->bytesPerRow;
+        if (i >= alloc->firstDimension) return numberOfBlocks(alloc) - 1;
+        size_t j = offset % alloc->bytesPerRow /
+            (alloc->bytesPerRow / alloc->columns);
+        return i * alloc->gridCols +
+            splitPart(alloc->columns, alloc->gridCols, j);
+    }
+
+    if (alloc->blockRows != 0) {
+        return min(offset / (alloc->blockRows * alloc->bytesPerRow),
+                numberOfBlocks(alloc) - 1);
+    }
+
+    size_t low = 0;
+    size_t high = Shray_size - 1;
+
+    while (low < high) {
+        size_t middle = low + (high - low + 1) / 2;
+        if (alloc->splitPoints[middle] * alloc->bytesPerRow <= offset) {
+            low = middle;
+        } else {
+            high = middle - 1;
+        }
+    }
+
+    return low;
+}
+
+/* Returns the rank r that owns address. */
+static inline unsigned int findOwner(Allocation *alloc, uintptr_t address)
+{
+    return blockOwner(alloc, findBlock(alloc, address));
+}
+
+/* The first block of ours that is not before findBlock(alloc, address), or
+ * numberOfBlocks(alloc) if there is none. Use nextLocalBlock for the rest. */
+static inline size_t firstLocalBlock(Allocation *alloc, uintptr_t address)
+{
+    size_t block = findBlock(alloc, address);
+
+    if (isTiled(alloc)) {
+        size_t gridRow = Shray_rank / alloc->gridCols;
+        size_t gridCol = Shray_rank % alloc->gridCols;
+        size_t rowStart = splitStart(alloc->firstDimension, alloc->gridRows,
+                gridRow);
+        size_t rowEnd = splitStart(alloc->firstDimension, alloc->gridRows,
+                gridRow + 1);
+        size_t row = max(block / alloc->gridCols, rowStart);
+        if (row == block / alloc->gridCols && block % alloc->gridCols > gridCol) {
+            row++;
+        }
+        return (row < rowEnd) ? row * alloc->gridCols + gridCol :
+            numberOfBlocks(alloc);
+    }
+
+    return min(block + (Shray_rank + Shray_size - blockOwner(alloc, block)) %
+            Shray_size, numberOfBlocks(alloc));
+}
+
+/* The first block of ours whose Ar_b may contain address, or a later one. */
+static inline size_t firstReadBlock(Allocation *alloc, uintptr_t address)
 {
-    return (endRead(alloc, rank - 1) == startRead(alloc, rank) + Shray_Pagesz) ?
-        startRead(alloc, rank) + Shray_Pagesz :
-        startRead(alloc, rank);
+    if (alloc->replicated) return firstLocalBlock(alloc, alloc->location);
+
+    return firstLocalBlock(alloc, address -
+            min(haloBytes(alloc), address - alloc->location));
 }
 
-static inline uintptr_t endPartition(Allocation *alloc, unsigned int rank)
+/* The block of ours after our block block, or numberOfBlocks(alloc). */
+static inline size_t nextLocalBlock(Allocation *alloc, size_t block)
 {
-    return endRead(alloc, rank);
+    if (isTiled(alloc)) {
+        size_t gridRow = Shray_rank / alloc->gridCols;
+        size_t rowEnd = splitStart(alloc->firstDimension, alloc->gridRows,
+                gridRow + 1);
+        return (block / alloc->gridCols + 1 < rowEnd) ?
+            block + alloc->gridCols : numberOfBlocks(alloc);
+    }
+
+    return min(block + Shray_size, numberOfBlocks(alloc));
 }
 
 /* Frees [start, end[. start, end need to be Shray_Pagesz-aligned */
@@ -137,7 +439,7 @@ static inline void freeRAM(uintptr_t start, uintptr_t end)
 
     DBUG_PRINT("We free [%p, %p[", (void *)start, (void *)end);
 
-    MUNMAP_SAFE((void *)start, end - start);
+    /* MAP_FIXED replaces whatever is mapped there, file or not. */
     MMAP_FIXED_SAFE((void *)start, end - start, PROT_NONE);
 }
 
@@ -179,10 +481,41 @@ static void evictCacheEntry(Allocation *alloc, uintptr_t start, size_t pages)
 {
     size_t index = (start - alloc->location) / Shray_Pagesz;
     size_t size = pages * Shray_Pagesz;
-    BitmapSetZeroes(alloc->local, index, index + pages);
 
     DBUG_PRINT("evictCacheEntry: we free page %zu", index);
     freeRAM(start, start + size);
+
+    /* Only once we no longer map them, other ranks may reuse the slots. */
+    if (alloc->hostMapped != NULL) {
+        for (size_t page = BitmapNextOne(alloc->local, index);
+                page < index + pages;
+                page = BitmapNextOne(alloc->local, page + 1)) {
+            size_t slot = alloc->hostMapped[page];
+            if (slot != 0) {
+                __atomic_sub_fetch(&alloc->hostSlots[slot - 1].users, 1,
+                        __ATOMIC_ACQ_REL);
+                alloc->hostMapped[page] = 0;
+            }
+        }
+    }
+
+    BitmapSetZeroes(alloc->local, index, index + pages);
+}
+
+/* Makes the pages readable and marks them as cached, so another node can put
+ * their contents. They stay until the next eviction, like faulted pages.
+ * Assumes start is page aligned. */
+static void addCacheEntry(Allocation *alloc, uintptr_t start, size_t pages)
+{
+    size_t index = (start - alloc->location) / Shray_Pagesz;
+
+    MPROTECT_SAFE((void *)start, pages * Shray_Pagesz, PROT_READ | PROT_WRITE);
+    BitmapSetOnes(alloc->local, index, index + pages);
+    if (alloc->fetchEpochs != NULL) {
+        for (size_t page = index; page < index + pages; page++) {
+            alloc->fetchEpochs[page] = alloc->epoch;
+        }
+    }
 }
 
 /* Assumes both pages are page-aligned. */
@@ -191,20 +524,281 @@ static inline int isNextPage(void *x, void *y)
     return (uintptr_t)y - (uintptr_t)x == Shray_Pagesz;
 }
 
+/* Maps a page for remote data outside the heap. If hugeShadowPages, it comes
+ * from the huge page pool while that has pages, and *huge is set. */
+static void *mapShadowPage(bool *huge)
+{
+    void *page;
+
+    *huge = false;
+#ifdef MAP_HUGETLB
+    if (hugeShadowPages) {
+        page = mmap(NULL, Shray_Pagesz, PROT_WRITE,
+                MAP_ANONYMOUS | MAP_PRIVATE | MAP_HUGETLB, -1, 0);
+        if (page != MAP_FAILED) {
+            *huge = true;
+            return page;
+        }
+        DBUG_PRINT("Could not map a huge page of %zu bytes, we stop using "
+                "them", Shray_Pagesz);
+        hugeShadowPages = false;
+    }
+#endif
+
+    MMAP_SAFE(page, NULL, Shray_Pagesz, PROT_WRITE);
+    /* Touch it first, so it is on the NUMA node of the thread that reads it,
+     * wherever the conduit writes it from. */
+    for (size_t offset = 0; offset < Shray_Pagesz;
+            offset += Shray_Pagesz / Shray_CacheLineSize) {
+        ((volatile char *)page)[offset] = 0;
+    }
+
+    return page;
+}
+
+/* True if page lies within a single Aw_b, so only its owner writes to it. */
+static bool isOwnedPage(Allocation *alloc, uintptr_t page)
+{
+    size_t block = findBlock(alloc, page);
+    uintptr_t end = endWrite(alloc, block);
+
+    return page >= startWrite(alloc, block) && (page + Shray_Pagesz <= end ||
+            end == alloc->location + alloc->size);
+}
+
+/* True if page was all zero when its owner last published it, see
+ * publishZeroPages. */
+static bool isZeroPage(Allocation *alloc, uintptr_t page)
+{
+    return isOwnedPage(alloc, page) &&
+        alloc->dataPages[(page - alloc->location) / Shray_Pagesz] == 0;
+}
+
+/* If we kept a copy of the page at address from before the last ShraySync,
+ * and its owner changed it at most once since, puts the copy into page and
+ * gets the changed parts from owner. Returns false if we need the whole page,
+ * see retainCachedPages and publishChanges. */
+static bool fetchDelta(Allocation *alloc, uintptr_t address,
+        unsigned int owner, void *page)
+{
+    size_t index = (address - alloc->location) / Shray_Pagesz;
+
+    if (alloc->deltas == NULL || !BitmapCheck(alloc->retained, index) ||
+            !isOwnedPage(alloc, address)) {
+        return false;
+    }
+
+    PageDelta delta;
+    gasnet_get(&delta, owner, alloc->deltas + index, sizeof(PageDelta));
+
+    size_t version = alloc->retainedEpochs[index];
+    if (delta.previousChanged > version) return false;
+
+    memcpy(page, alloc->previous + (address - alloc->location), Shray_Pagesz);
+    if (delta.changed <= version) {
+        DELTASAVEDCOUNT(Shray_Pagesz);
+        return true;
+    }
+
+    size_t segment = Shray_Pagesz / DELTA_SEGMENTS;
+    size_t changed = 0;
+    size_t k = 0;
+    while (k < DELTA_SEGMENTS) {
+        size_t end = k;
+        while (end < DELTA_SEGMENTS && (delta.mask >> end & 1)) end++;
+
+        if (end > k) {
+            gasnet_get_nbi_bulk((char *)page + k * segment, owner,
+                    (void *)(address + k * segment), (end - k) * segment);
+            changed += end - k;
+        } else {
+            end++;
+        }
+
+        k = end;
+    }
+    gasnet_wait_syncnbi_gets();
+
+    DBUG_PRINT("Refetched %zu of %d parts of %p", changed, DELTA_SEGMENTS,
+            (void *)address);
+    DELTASAVEDCOUNT((DELTA_SEGMENTS - changed) * segment);
+
+    return true;
+}
+
+/* Returns a slot of the host cache that no rank maps, or SIZE_MAX if there is
+ * none. Slots are reused round robin. Needs the host cache lock. */
+static size_t takeHostSlot(Allocation *alloc)
+{
+    HostCacheHeader *header = alloc->hostCache;
+
+    for (size_t k = 0; k < alloc->numberOfHostSlots; k++) {
+        size_t slot = header->hand;
+        header->hand = (slot + 1) % alloc->numberOfHostSlots;
+
+        HostSlot *candidate = alloc->hostSlots + slot;
+        if (__atomic_load_n(&candidate->users, __ATOMIC_ACQUIRE) == 0) {
+            if (alloc->hostNewest[candidate->page] == slot + 1) {
+                alloc->hostNewest[candidate->page] = 0;
+            }
+            return slot;
+        }
+    }
+
+    return SIZE_MAX;
+}
+
+/* Maps the page at address from the cache of our host. If no rank on our host
+ * has fetched it in this epoch, we fetch it from owner into a slot no rank
+ * maps, see fetchDelta, so ranks that still map an older copy keep it. The
+ * mapping is private, so a write stays ours. Returns false if every slot is
+ * mapped. */
+static bool fetchHostCached(Allocation *alloc, uintptr_t address,
+        unsigned int owner)
+{
+    size_t page = (address - alloc->location) / Shray_Pagesz;
+    bool fetch = false;
+
+    pthread_mutex_lock(&alloc->hostCache->lock);
+    size_t slot = alloc->hostNewest[page];
+    if (slot != 0 && alloc->hostSlots[slot - 1].epoch == alloc->epoch) {
+        slot--;
+    } else {
+        slot = takeHostSlot(alloc);
+        if (slot == SIZE_MAX) {
+            pthread_mutex_unlock(&alloc->hostCache->lock);
+            return false;
+        }
+        alloc->hostSlots[slot].page = page;
+        alloc->hostSlots[slot].epoch = alloc->epoch;
+        alloc->hostSlots[slot].ready = 0;
+        alloc->hostNewest[page] = slot + 1;
+        fetch = true;
+    }
+    HostSlot *cached = alloc->hostSlots + slot;
+    __atomic_add_fetch(&cached->users, 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_unlock(&alloc->hostCache->lock);
+
+    char *contents = alloc->hostSlotPages + slot * Shray_Pagesz;
+    if (fetch) {
+        FETCHCOUNT(Shray_Pagesz);
+        if (!fetchDelta(alloc, address, owner, contents)) {
+            gasnet_get(contents, owner, (void *)address, Shray_Pagesz);
+        }
+        __atomic_store_n(&cached->ready, 1, __ATOMIC_RELEASE);
+    } else {
+        /* Another rank on our host is fetching it. */
+        while (!__atomic_load_n(&cached->ready, __ATOMIC_ACQUIRE));
+    }
+
+    void *mapped = mmap((void *)address, Shray_Pagesz, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_FIXED, alloc->hostCacheFd,
+            contents - (char *)alloc->hostCache);
+    if (mapped == MAP_FAILED) {
+        fprintf(stderr, "[node %d]: ", Shray_rank);
+        perror("mapping a page of the host cache failed");
+        gasnet_exit(1);
+    }
+    alloc->hostMapped[page] = slot + 1;
+
+    return true;
+}
+
 static void handlePageFault(uintptr_t roundedAddress, Allocation *alloc)
 {
-    uintptr_t difference = roundedAddress - alloc->location;
-    unsigned int owner = difference / alloc->bytesPerBlock;
+    unsigned int owner = findOwner(alloc, roundedAddress);
 
     DBUG_PRINT("Segfault is owned by node %d.", owner);
 
-    void *shadowPage;
-    MMAP_SAFE(shadowPage, NULL, Shray_Pagesz, PROT_WRITE);
-    gasnet_get(shadowPage, owner, (void *)roundedAddress, Shray_Pagesz);
+    /* Fresh memory is zero, so we need not ask the owner. */
+    if (isZeroPage(alloc, roundedAddress)) {
+        DBUG_PRINT("%p is all zero", (void *)roundedAddress);
+        MPROTECT_SAFE((void *)roundedAddress, Shray_Pagesz,
+                alloc->multiWriter ? PROT_READ : PROT_READ | PROT_WRITE);
+        return;
+    }
+
+    /* The owner runs on our host, so we map its page instead of copying it.
+     * The mapping is private, so a write never reaches the owner. */
+    if (alloc->hostFds != NULL && alloc->hostFds[owner] != -1 &&
+            !alloc->multiWriter) {
+        void *page = mmap((void *)roundedAddress, Shray_Pagesz,
+                PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                alloc->hostFds[owner], roundedAddress - alloc->location);
+        if (page == MAP_FAILED) {
+            fprintf(stderr, "[node %d]: ", Shray_rank);
+            perror("mapping a page of a node on our host failed");
+            gasnet_exit(1);
+        }
+        return;
+    }
+
+    if (alloc->hostCache != NULL && !alloc->multiWriter &&
+            fetchHostCached(alloc, roundedAddress, owner)) {
+        return;
+    }
+
+    bool huge;
+    void *shadowPage = mapShadowPage(&huge);
+    FETCHCOUNT(Shray_Pagesz);
+    if (!fetchDelta(alloc, roundedAddress, owner, shadowPage)) {
+        gasnet_get(shadowPage, owner, (void *)roundedAddress, Shray_Pagesz);
+    }
+
+    /* So we notice the first write to the page. */
+    if (alloc->multiWriter) {
+        MPROTECT_SAFE(shadowPage, Shray_Pagesz, PROT_READ);
+    }
+
+    /* Kernels before 5.19 cannot move huge pages, then we copy. */
+    if (huge && mremap(shadowPage, Shray_Pagesz, Shray_Pagesz,
+                MREMAP_MAYMOVE | MREMAP_FIXED, (void *)roundedAddress) !=
+            MAP_FAILED) {
+        return;
+    } else if (huge) {
+        DBUG_PRINT("Could not move a huge page to %p, we stop using them",
+                (void *)roundedAddress);
+        hugeShadowPages = false;
+        void *copy = mapShadowPage(&huge);
+        memcpy(copy, shadowPage, Shray_Pagesz);
+        MUNMAP_SAFE(shadowPage, Shray_Pagesz);
+        shadowPage = copy;
+        if (alloc->multiWriter) {
+            MPROTECT_SAFE(shadowPage, Shray_Pagesz, PROT_READ);
+        }
+    }
 
     MREMAP_MOVE((void *)roundedAddress, shadowPage, Shray_Pagesz);
 }
 
+/* Adds a twin for [start, start + Shray_Pagesz[, copying its current
+ * contents. */
+static void addTwin(Allocation *alloc, uintptr_t start)
+{
+    if (alloc->numberOfTwins == alloc->twinsSize) {
+        alloc->twinsSize = max(2 * alloc->twinsSize, 16);
+        REALLOC_SAFE(alloc->twins, alloc->twinsSize * sizeof(Twin));
+    }
+
+    Twin *twin = alloc->twins + alloc->numberOfTwins;
+    twin->page = start;
+    MALLOC_SAFE(twin->copy, Shray_Pagesz);
+    memcpy(twin->copy, (void *)start, Shray_Pagesz);
+    alloc->numberOfTwins++;
+}
+
+/* Called on the first write to a cached page of a multi-writer allocation. */
+static void handleWriteFault(uintptr_t roundedAddress, Allocation *alloc)
+{
+    size_t pageNumber = (roundedAddress - alloc->location) / Shray_Pagesz;
+
+    DBUG_PRINT("Creating twin of %p", (void *)roundedAddress);
+
+    addTwin(alloc, roundedAddress);
+    BitmapSetOne(alloc->twinned, pageNumber);
+    MPROTECT_SAFE((void *)roundedAddress, Shray_Pagesz, PROT_READ | PROT_WRITE);
+}
+
 static inline void atomic_clear(bool *p)
 {
         __atomic_clear(p, __ATOMIC_SEQ_CST);
@@ -241,16 +835,39 @@ static void SegvHandler(int sig, siginfo_t *si, void *unused)
     Allocation *alloc = findAlloc((void *)roundedAddress);
     size_t pageNumber = (roundedAddress - alloc->location) / Shray_Pagesz;
 
+    /* Multi-writer allocations fetch under the lock, so a fault on a page we
+     * have cached is always a write to a read-only page. */
+    if (alloc->multiWriter && BitmapCheck(alloc->local, pageNumber)) {
+        if (!BitmapCheck(alloc->twinned, pageNumber)) {
+            handleWriteFault(roundedAddress, alloc);
+        }
+        unlock();
+        return;
+    }
+
     if (!BitmapCheck(alloc->local, pageNumber)) {
         SEGFAULTCOUNT;
         mine = true;
-        BitmapSetOne(alloc->local, pageNumber);
         if (ringbuffer_full(alloc->autoCaches)) {
             cache_entry_t *entry = ringbuffer_front(alloc->autoCaches);
-            DBUG_PRINT("Cache buffer is full, evicting %p", entry->start);
-            evictCacheEntry(alloc, (uintptr_t)entry->start, 1);
+            uintptr_t start = (uintptr_t)entry->start;
+            /* Twinned pages hold writes that still need to be merged. */
+            if (!alloc->multiWriter || !BitmapCheck(alloc->twinned,
+                        (start - alloc->location) / Shray_Pagesz)) {
+                DBUG_PRINT("Cache buffer is full, evicting %p", entry->start);
+                evictCacheEntry(alloc, start, 1);
+            }
         }
         ringbuffer_add(alloc->autoCaches, alloc, (void*)roundedAddress);
+        BitmapSetOne(alloc->local, pageNumber);
+        if (alloc->fetchEpochs != NULL) {
+            alloc->fetchEpochs[pageNumber] = alloc->epoch;
+        }
+    }
+
+    if (mine && alloc->multiWriter) {
+        handlePageFault(roundedAddress, alloc);
+        mine = false;
     }
     unlock();
 
@@ -272,226 +889,3004 @@ static void registerHandlers(void)
     }
 }
 
-/* Is linear in the number of allocations */
-static void ShrayResetCache(Allocation *alloc)
+/* Calls fn(alloc, start, pages) on the maximal runs of pages in [first, last[
+ * that are not in one of our Ar_b. first and last need to be
+ * Shray_Pagesz-aligned. */
+static void forRemotePages(Allocation *alloc, uintptr_t first, uintptr_t last,
+        void (*fn)(Allocation *, uintptr_t, size_t))
 {
-    freeRAM(alloc->location, startRead(alloc, Shray_rank));
-    freeRAM(endRead(alloc, Shray_rank), alloc->location + alloc->size);
+    size_t blocks = numberOfBlocks(alloc);
+
+    for (size_t block = firstReadBlock(alloc, first);
+            block < blocks && first < last;
+            block = nextLocalBlock(alloc, block)) {
+        uintptr_t readStart = min(startRead(alloc, block), last);
+        if (first < readStart) {
+            fn(alloc, first, (readStart - first) / Shray_Pagesz);
+        }
+        first = max(first, endRead(alloc, block));
+    }
 
-    ringbuffer_reset(alloc->autoCaches);
-    BitmapReset(alloc->local);
+    if (first < last) {
+        fn(alloc, first, (last - first) / Shray_Pagesz);
+    }
 }
 
-/*****************************************************
- * Shray functionality
- *****************************************************/
+/* Drops our cached copies of the pages in [first, last[, that is the pages
+ * that are not in one of our Ar_b. */
+static void evictRemotePages(Allocation *alloc, uintptr_t first, uintptr_t last)
+{
+    forRemotePages(alloc, first, last, evictCacheEntry);
+}
 
-void ShrayInit(int *argc, char ***argv)
+/* Keeps a copy of the remote pages we cached, so we can refetch only what
+ * changed in them, see fetchDelta. Drops the copies of pages we did not cache
+ * again once they are more than RETAIN_EPOCHS old. */
+static void retainCachedPages(Allocation *alloc)
 {
-    GASNET_SAFE(gasnet_init(argc, argv));
-    /* Must be built with GASNET_SEGMENT_EVERYTHING, so these arguments are
-     * ignored. */
-    GASNET_SAFE(gasnet_attach(NULL, 0, 4096, 0));
+    size_t pages = alloc->local->size;
+
+    size_t page = BitmapNextOne(alloc->retained, 0);
+    while (page < pages) {
+        size_t end = page;
+        while (end < pages && BitmapCheck(alloc->retained, end) &&
+                !BitmapCheck(alloc->local, end) &&
+                alloc->epoch - alloc->retainedEpochs[end] > RETAIN_EPOCHS) {
+            end++;
+        }
 
-    Shray_size = gasnet_nodes();
-    Shray_rank = gasnet_mynode();
+        if (end > page) {
+            madvise(alloc->previous + page * Shray_Pagesz,
+                    (end - page) * Shray_Pagesz, MADV_DONTNEED);
+            BitmapSetZeroes(alloc->retained, page, end);
+        } else {
+            end++;
+        }
 
-    ShrayOutput = (Shray_rank == 0);
+        page = BitmapNextOne(alloc->retained, end);
+    }
 
-    Shray_SegfaultCounter = 0;
-    Shray_BarrierCounter = 0;
+    page = BitmapNextOne(alloc->local, 0);
+    while (page < pages) {
+        size_t end = page + 1;
+        while (end < pages && BitmapCheck(alloc->local, end)) end++;
+
+        memcpy(alloc->previous + page * Shray_Pagesz,
+                (void *)(alloc->location + page * Shray_Pagesz),
+                (end - page) * Shray_Pagesz);
+        BitmapSetOnes(alloc->retained, page, end);
+        for (size_t k = page; k < end; k++) {
+            alloc->retainedEpochs[k] = alloc->fetchEpochs[k];
+        }
 
-    if(gethostname(ShrayHost, HOSTNAME_LENGTH) != 0) {
-        ShrayHost[0] = '\0';
+        page = BitmapNextOne(alloc->local, end);
     }
+}
 
-    char *cacheLineEnv = getenv("SHRAY_CACHELINE");
-    if (cacheLineEnv == NULL) {
-        Shray_CacheLineSize = 1;
-    } else {
-        Shray_CacheLineSize = atol(cacheLineEnv);
+/* Is linear in the number of allocations */
+static void ShrayResetCache(Allocation *alloc)
+{
+    if (alloc->deltas != NULL) {
+        retainCachedPages(alloc);
     }
 
-    int pagesz = sysconf(_SC_PAGE_SIZE);
-    if (pagesz == -1) {
-        perror("Querying system page size failed.");
-    }
+    evictRemotePages(alloc, alloc->location,
+            roundUpPage(alloc->location + alloc->size));
 
-    Shray_Pagesz = (size_t)pagesz * Shray_CacheLineSize;
+    ringbuffer_reset(alloc->autoCaches);
+    BitmapReset(alloc->local);
+}
 
-    heap.size = sizeof(Allocation);
-    heap.numberOfAllocs = 0;
-    MALLOC_SAFE(heap.allocs, sizeof(Allocation));
+/* True if the page of entry is still cached, see dropEvictedEntries. */
+static int isCachedEntry(const cache_entry_t *entry, void *arg)
+{
+    Allocation *alloc = arg;
+    size_t page = ((uintptr_t)entry->start - alloc->location) / Shray_Pagesz;
 
-    char *cacheSizeEnv = getenv("SHRAY_CACHEFACTOR");
-    if (cacheSizeEnv == NULL) {
-        Shray_CacheAllocFactor = 1;
-    } else {
-        Shray_CacheAllocFactor = strtod(cacheSizeEnv, NULL);
-    }
+    return BitmapCheck(alloc->local, page);
+}
 
-    registerHandlers();
+/* Removes the ring entries of pages we evicted outside of the ring, so they
+ * take no room, and popping one later does not evict the page again after we
+ * refetched it. */
+static void dropEvictedEntries(Allocation *alloc)
+{
+    ringbuffer_filter(alloc->autoCaches, isCachedEntry, alloc);
 }
 
-void *ShrayMalloc(size_t firstDimension, size_t totalSize)
+/* Drops our cached copies of the pages intersecting [start, end[. */
+static void invalidateRange(Allocation *alloc, uintptr_t start, uintptr_t end)
 {
-    lock();
+    evictRemotePages(alloc, roundDownPage(start), roundUpPage(end));
+    dropEvictedEntries(alloc);
+}
 
-    void *location;
+/* True if the page starting at page is in one of our Ar_b. */
+static bool isLocalPage(Allocation *alloc, uintptr_t page)
+{
+    size_t blocks = numberOfBlocks(alloc);
 
-    /* For the segfault handler, we need the start of each allocation to be
-     * Shray_Pagesz-aligned. We cheat a little by making it possible for this
-     * to be multiple system-pages. So we mmap an extra page at the start and
-     * end, and then move the pointer up. */
-    if (Shray_rank == 0) {
-        void *mmapAddress;
-        MMAP_SAFE(mmapAddress, NULL, totalSize + 2 * Shray_Pagesz, PROT_NONE);
-        location = (void *)roundUpPage((uintptr_t)mmapAddress);
-        DBUG_PRINT("mmapAddress = %p, allocation start = %p",
-                mmapAddress, location);
+    for (size_t block = firstReadBlock(alloc, page);
+            block < blocks && startRead(alloc, block) <= page;
+            block = nextLocalBlock(alloc, block)) {
+        if (page < endRead(alloc, block)) return true;
     }
 
-    /* Broadcast location to the other nodes. */
-    gasnet_coll_broadcast(gasnete_coll_team_all, &location, 0, &location,
-            sizeof(void *), GASNET_COLL_DST_IN_SEGMENT);
+    return false;
+}
 
-    if (Shray_rank != 0) {
-        MMAP_FIXED_SAFE(location, totalSize + Shray_Pagesz, PROT_NONE);
-    }
+/* Evicts the cached pages in [firstPage, lastPage[ that were fetched more than
+ * alloc->maxStaleness epochs ago, so they are refetched on the next access.
+ * The other cached pages stay valid. */
+static void evictStalePages(Allocation *alloc, size_t firstPage,
+        size_t lastPage)
+{
+    size_t pages = min(lastPage, alloc->local->size);
+    size_t page = BitmapNextOne(alloc->local, firstPage);
+
+    while (page < pages) {
+        size_t end = page;
+        while (end < pages && BitmapCheck(alloc->local, end) &&
+                alloc->epoch - alloc->fetchEpochs[end] > alloc->maxStaleness) {
+            end++;
+        }
 
-    /* Insert allocation into the heap, making sure allocs stays sorted. */
-    heap.numberOfAllocs++;
-    if (heap.numberOfAllocs > heap.size / sizeof(Allocation)) {
-        REALLOC_SAFE(heap.allocs, 2 * heap.size);
-        heap.size *= 2;
-    }
-    int index = heap.numberOfAllocs - 1;
-    while (index > 0 && heap.allocs[index - 1].location > (uintptr_t)location) {
-        heap.allocs[index] = heap.allocs[index - 1];
-        index--;
+        if (end > page) {
+            DBUG_PRINT("Evicting stale pages [%zu, %zu[", page, end);
+            evictCacheEntry(alloc, alloc->location + page * Shray_Pagesz,
+                    end - page);
+        } else {
+            end++;
+        }
+
+        page = BitmapNextOne(alloc->local, end);
     }
 
-    Allocation *alloc = heap.allocs + index;
+    dropEvictedEntries(alloc);
+}
 
-    /* We distribute blockwise over the first dimension. */
-    size_t bytesPerLatterDimensions = totalSize / firstDimension;
-    size_t bytesPerBlock = roundUp(firstDimension, Shray_size) *
-        bytesPerLatterDimensions;
+/* Puts [start, end[ into the memory of the nodes that own it, skipping the
+ * part we own ourselves. */
+static void putToOwners(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    while (start < end) {
+        size_t block = findBlock(alloc, start);
+        unsigned int owner = blockOwner(alloc, block);
+        uintptr_t stop = min(end, endWrite(alloc, block));
+        if (owner != Shray_rank) {
+            DBUG_PRINT("Merging [%p, %p[ into node %u",
+                    (void *)start, (void *)stop, owner);
+            gasnet_put_nbi_bulk(owner, (void *)start, (void *)start,
+                    stop - start);
+        }
+        start = stop;
+    }
+}
 
-    alloc->firstDimension = firstDimension;
+/* Sends the bytes of the page that differ from its twin to their owners. */
+static void putDiff(Allocation *alloc, Twin *twin)
+{
+    const char *current = (const char *)twin->page;
+    const char *copy = (const char *)twin->copy;
+    size_t n = min(Shray_Pagesz, alloc->location + alloc->size - twin->page);
+    size_t i = 0;
+
+    while (i < n) {
+        /* Skip unchanged words quickly. */
+        if (i % 8 == 0 && i + 8 <= n && memcmp(current + i, copy + i, 8) == 0) {
+            i += 8;
+        } else if (current[i] == copy[i]) {
+            i++;
+        } else {
+            size_t runStart = i;
+            while (i < n && current[i] != copy[i]) i++;
+            putToOwners(alloc, twin->page + runStart, twin->page + i);
+        }
+    }
+}
+
+/* Sends our writes to the twinned pages intersecting [start, end[ to their
+ * owners. */
+static void mergeTwins(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    for (size_t i = 0; i < alloc->numberOfTwins; i++) {
+        Twin *twin = alloc->twins + i;
+        if (twin->page < end && start < twin->page + Shray_Pagesz) {
+            putDiff(alloc, twin);
+        }
+    }
+}
+
+/* To be called after the writes to the pages intersecting [start, end[ have
+ * been published. Drops the twins of those pages, except for our boundary
+ * pages, whose twin is refreshed. */
+static void resetTwins(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    size_t kept = 0;
+
+    for (size_t i = 0; i < alloc->numberOfTwins; i++) {
+        Twin twin = alloc->twins[i];
+
+        if (twin.page < end && start < twin.page + Shray_Pagesz) {
+            if (!isLocalPage(alloc, twin.page)) {
+                size_t pageNumber = (twin.page - alloc->location) /
+                    Shray_Pagesz;
+                BitmapSetZeroes(alloc->twinned, pageNumber, pageNumber + 1);
+                free(twin.copy);
+                continue;
+            }
+            memcpy(twin.copy, (void *)twin.page, Shray_Pagesz);
+        }
+
+        alloc->twins[kept] = twin;
+        kept++;
+    }
+
+    alloc->numberOfTwins = kept;
+}
+
+static void freeTwins(Allocation *alloc)
+{
+    for (size_t i = 0; i < alloc->numberOfTwins; i++) {
+        free(alloc->twins[i].copy);
+    }
+    alloc->numberOfTwins = 0;
+}
+
+/* The first and last page of our Ar_b may contain elements owned by other
+ * nodes, which we can write to without a fault, so we always twin those. */
+static void twinBoundaryPages(Allocation *alloc)
+{
+    size_t blocks = numberOfBlocks(alloc);
+
+    for (size_t block = firstLocalBlock(alloc, alloc->location);
+            block < blocks; block = nextLocalBlock(alloc, block)) {
+        uintptr_t first = startRead(alloc, block);
+        uintptr_t last = endRead(alloc, block) - Shray_Pagesz;
+
+        if (startWrite(alloc, block) >= endWrite(alloc, block)) continue;
+
+        /* Consecutive blocks of ours may share a page. */
+        if (alloc->numberOfTwins == 0 ||
+                alloc->twins[alloc->numberOfTwins - 1].page != first) {
+            addTwin(alloc, first);
+        }
+        if (last != first) {
+            addTwin(alloc, last);
+        }
+    }
+}
+
+/*****************************************************
+ * Remote updates (ShrayAccumulate, ShrayPut)
+ *****************************************************/
+
+static size_t typeSize(ShrayType type)
+{
+    switch (type) {
+        case SHRAY_FLOAT:
+            return sizeof(float);
+        case SHRAY_DOUBLE:
+            return sizeof(double);
+        case SHRAY_INT64:
+            return sizeof(int64_t);
+    }
+
+    fprintf(stderr, "[node %d]: Unknown ShrayType %d\n", Shray_rank, type);
+    gasnet_exit(1);
+}
+
+/* Number of value bytes following the header. */
+static size_t recordBytes(UpdateRecord *record)
+{
+    return (record->op == RECORD_PUT) ? record->n :
+        record->n * typeSize(record->type);
+}
+
+#define APPLY(T, dest, values, n, op)                                         \
+    {                                                                         \
+        T *d = (T *)(dest);                                                   \
+        const T *v = (const T *)(values);                                     \
+        switch (op) {                                                         \
+            case SHRAY_SUM:                                                   \
+                for (size_t i = 0; i < n; i++) d[i] += v[i];                  \
+                break;                                                        \
+            case SHRAY_MIN:                                                   \
+                for (size_t i = 0; i < n; i++) d[i] = min_##T(d[i], v[i]);    \
+                break;                                                        \
+            case SHRAY_MAX:                                                   \
+                for (size_t i = 0; i < n; i++) d[i] = max_##T(d[i], v[i]);    \
+                break;                                                        \
+        }                                                                     \
+    }
+
+#define MINMAX(T)                                                             \
+    static inline T min_##T(T x, T y) { return x < y ? x : y; }              \
+    static inline T max_##T(T x, T y) { return x > y ? x : y; }
+
+MINMAX(float)
+MINMAX(double)
+MINMAX(int64_t)
+
+/* Applies dest[i] = op(dest[i], values[i]) for 0 <= i < n, dest has to be
+ * in our partition. */
+static void applyAccumulate(void *dest, const void *values, size_t n,
+        ShrayType type, ShrayOp op)
+{
+    while (atomic_test_set(&update_lock));
+
+    switch (type) {
+        case SHRAY_FLOAT:
+            APPLY(float, dest, values, n, op);
+            break;
+        case SHRAY_DOUBLE:
+            APPLY(double, dest, values, n, op);
+            break;
+        case SHRAY_INT64:
+            APPLY(int64_t, dest, values, n, op);
+            break;
+    }
+
+    atomic_clear(&update_lock);
+}
+
+/* Copies [source, source + size[ to dest, which has to be in our partition. */
+static void applyPut(void *dest, const void *source, size_t size)
+{
+    while (atomic_test_set(&update_lock));
+    memcpy(dest, source, size);
+    atomic_clear(&update_lock);
+}
+
+static void UpdateHandler(gasnet_token_t token, void *buf, size_t nbytes)
+{
+    char *record = buf;
+
+    while (record < (char *)buf + nbytes) {
+        UpdateRecord *header = (UpdateRecord *)record;
+        char *values = record + sizeof(UpdateRecord);
+        if (header->op == RECORD_PUT) {
+            applyPut((void *)header->address, values, header->n);
+        } else {
+            applyAccumulate((void *)header->address, values, header->n,
+                    header->type, header->op);
+        }
+        record = values + roundUp(recordBytes(header), 8) * 8;
+    }
+
+    gasnet_AMReplyShort0(token, HANDLER_UPDATE_ACK);
+}
+
+static void UpdateAckHandler(gasnet_token_t token)
+{
+    (void)token;
+    __atomic_fetch_sub(&updatesInFlight, 1, __ATOMIC_SEQ_CST);
+}
+
+static void RingHandler(gasnet_token_t token)
+{
+    (void)token;
+    __atomic_fetch_add(&ringArrived, 1, __ATOMIC_SEQ_CST);
+}
+
+/* Sends the buffered updates for node owner. */
+static void flushUpdates(unsigned int owner)
+{
+    updateLast[owner] = NO_RECORD;
+
+    if (updateFill[owner] == 0) return;
+
+    DBUG_PRINT("Sending %zu bytes of updates to node %u",
+            updateFill[owner], owner);
+
+    __atomic_fetch_add(&updatesInFlight, 1, __ATOMIC_SEQ_CST);
+    GASNET_SAFE(gasnet_AMRequestMedium0(owner, HANDLER_UPDATE,
+                updateBuffers[owner], updateFill[owner]));
+    updateFill[owner] = 0;
+}
+
+/* Sends all buffered updates and waits until they have been applied. */
+static void completeUpdates(void)
+{
+    while (atomic_test_set(&buffer_lock));
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        flushUpdates(rank);
+    }
+    atomic_clear(&buffer_lock);
+
+    GASNET_BLOCKUNTIL(__atomic_load_n(&updatesInFlight,
+                __ATOMIC_SEQ_CST) == 0);
+}
+
+/* Starts a new record in the buffer of owner, sending the buffer first if it
+ * has no room for the header and 8 bytes of values. Stores the number of
+ * value bytes that fit in the record in room. */
+static UpdateRecord *newRecord(unsigned int owner, size_t *room)
+{
+    size_t capacity = gasnet_AMMaxMedium();
+
+    if (updateBuffers[owner] == NULL) {
+        MALLOC_SAFE(updateBuffers[owner], capacity);
+    }
+
+    size_t start = roundUp(updateFill[owner], 8) * 8;
+    if (start + sizeof(UpdateRecord) + 8 > capacity) {
+        flushUpdates(owner);
+        start = 0;
+    }
+
+    updateLast[owner] = start;
+    updateFill[owner] = start + sizeof(UpdateRecord);
+    *room = capacity - updateFill[owner];
+
+    return (UpdateRecord *)(updateBuffers[owner] + start);
+}
+
+/* Buffers [address, address + n * typeSize(type)[ op= values for owner, the
+ * caller holds buffer_lock. */
+static void bufferAccumulate(unsigned int owner, uintptr_t address,
+        const char *values, size_t n, ShrayType type, ShrayOp op)
+{
+    size_t elementSize = typeSize(type);
+
+    while (n > 0) {
+        size_t room;
+        UpdateRecord *record = newRecord(owner, &room);
+        size_t count = min(n, room / elementSize);
+
+        record->address = address;
+        record->n = count;
+        record->type = type;
+        record->op = op;
+        memcpy(updateBuffers[owner] + updateFill[owner], values,
+                count * elementSize);
+        updateFill[owner] += count * elementSize;
+
+        address += count * elementSize;
+        values += count * elementSize;
+        n -= count;
+    }
+}
+
+/* Buffers a copy of [source, source + size[ to address for owner, the caller
+ * holds buffer_lock. Puts that continue where the previous put to owner ended
+ * are combined into a single record. */
+static void bufferPut(unsigned int owner, uintptr_t address,
+        const char *source, size_t size)
+{
+    size_t capacity = gasnet_AMMaxMedium();
+
+    while (size > 0) {
+        UpdateRecord *record = (updateLast[owner] == NO_RECORD) ? NULL :
+            (UpdateRecord *)(updateBuffers[owner] + updateLast[owner]);
+        size_t room;
+
+        if (record != NULL && record->op == RECORD_PUT &&
+                record->address + record->n == address &&
+                updateFill[owner] < capacity) {
+            room = capacity - updateFill[owner];
+        } else {
+            record = newRecord(owner, &room);
+            record->address = address;
+            record->n = 0;
+            record->type = 0;
+            record->op = RECORD_PUT;
+        }
+
+        size_t count = min(size, room);
+        memcpy(updateBuffers[owner] + updateFill[owner], source, count);
+        updateFill[owner] += count;
+        record->n += count;
+
+        address += count;
+        source += count;
+        size -= count;
+    }
+}
+
+/*****************************************************
+ * Symmetric heap
+ *****************************************************/
+
+/* Reserves the address space the allocations are carved from, at the same
+ * address on every node. Its size is SHRAY_HEAPSIZE bytes, 1 TiB by default,
+ * which costs no memory until it is used. */
+static void reserveHeap(void)
+{
+    size_t reserve = (size_t)1 << 40;
+    char *heapSizeEnv = getenv("SHRAY_HEAPSIZE");
+    if (heapSizeEnv != NULL) {
+        reserve = strtoull(heapSizeEnv, NULL, 10);
+    }
+    /* For the segfault handler, we need the start of each allocation to be
+     * Shray_Pagesz-aligned, which may be multiple system pages. */
+    size_t length = roundUpPage(reserve) + Shray_Pagesz;
+
+    void *start = NULL;
+    int flags = MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE;
+    if (Shray_rank == 0) {
+        start = mmap(NULL, length, PROT_NONE, flags, -1, 0);
+    }
+
+    gasnet_coll_broadcast(gasnete_coll_team_all, &start, 0, &start,
+            sizeof(void *), GASNET_COLL_DST_IN_SEGMENT);
+
+    if (start == MAP_FAILED) {
+        fprintf(stderr, "[node %d]: Could not reserve %zu bytes for the heap, "
+                "lower SHRAY_HEAPSIZE\n", Shray_rank, length);
+        gasnet_exit(1);
+    }
+
+    if (Shray_rank != 0) {
+#ifdef MAP_FIXED_NOREPLACE
+        flags |= MAP_FIXED_NOREPLACE;
+#endif
+        /* Unlike MAP_FIXED, this never replaces one of our mappings. */
+        void *address = mmap(start, length, PROT_NONE, flags, -1, 0);
+        if (address != start) {
+            fprintf(stderr, "[node %d]: Could not reserve the heap at %p, "
+                    "lower SHRAY_HEAPSIZE\n", Shray_rank, start);
+            gasnet_exit(1);
+        }
+    }
+
+    heap.reservedStart = roundUpPage((uintptr_t)start);
+    heap.reservedEnd = heap.reservedStart + roundUpPage(reserve);
+    heap.top = heap.reservedStart;
+    for (unsigned int sizeClass = 0; sizeClass < SIZE_CLASSES; sizeClass++) {
+        heap.freeChunks[sizeClass] = NULL;
+        heap.numberOfFreeChunks[sizeClass] = 0;
+        heap.freeChunksSize[sizeClass] = 0;
+    }
+
+    DBUG_PRINT("Reserved [%p, %p[ for the heap", (void *)heap.reservedStart,
+            (void *)heap.reservedEnd);
+}
+
+/* The smallest size class that fits size bytes. */
+static unsigned int sizeClass(size_t size)
+{
+    unsigned int sizeClass = 0;
+    while ((Shray_Pagesz << sizeClass) < size) sizeClass++;
+    return sizeClass;
+}
+
+/* Returns a PROT_NONE chunk of at least size bytes. */
+static uintptr_t takeChunk(size_t size)
+{
+    unsigned int class = sizeClass(size);
+
+    if (class >= SIZE_CLASSES) {
+        fprintf(stderr, "[node %d]: Allocation of %zu bytes is too large\n",
+                Shray_rank, size);
+        gasnet_exit(1);
+    }
+
+    if (heap.numberOfFreeChunks[class] > 0) {
+        heap.numberOfFreeChunks[class]--;
+        return heap.freeChunks[class][heap.numberOfFreeChunks[class]];
+    }
+
+    size_t chunkSize = Shray_Pagesz << class;
+    if (heap.reservedEnd - heap.top < chunkSize) {
+        fprintf(stderr, "[node %d]: Heap exhausted allocating %zu bytes, raise "
+                "SHRAY_HEAPSIZE\n", Shray_rank, size);
+        gasnet_exit(1);
+    }
+
+    uintptr_t chunk = heap.top;
+    heap.top += chunkSize;
+    return chunk;
+}
+
+/* Frees the memory of the chunk of an allocation of size bytes, and keeps it
+ * for reuse. If the chunk only maps private anonymous memory, we keep the
+ * mapping and drop its pages, otherwise we replace it. */
+static void returnChunk(uintptr_t chunk, size_t size, bool anonymous)
+{
+    unsigned int class = sizeClass(size);
+    size_t chunkSize = Shray_Pagesz << class;
+
+    /* Older kernels refuse MADV_DONTNEED on huge shadow pages. */
+    if (anonymous && madvise((void *)chunk, chunkSize, MADV_DONTNEED) == 0) {
+        MPROTECT_SAFE((void *)chunk, chunkSize, PROT_NONE);
+    } else {
+        freeRAM(chunk, chunk + chunkSize);
+    }
+
+    if (heap.numberOfFreeChunks[class] == heap.freeChunksSize[class]) {
+        heap.freeChunksSize[class] = max(2 * heap.freeChunksSize[class], 4);
+        REALLOC_SAFE(heap.freeChunks[class],
+                heap.freeChunksSize[class] * sizeof(uintptr_t));
+    }
+    heap.freeChunks[class][heap.numberOfFreeChunks[class]] = chunk;
+    heap.numberOfFreeChunks[class]++;
+}
+
+/*****************************************************
+ * NUMA placement
+ *****************************************************/
+
+/* We call mbind(2) directly, so we do not depend on libnuma. */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+#ifndef MPOL_MF_MOVE
+#define MPOL_MF_MOVE (1 << 1)
+#endif
+#ifndef MPOL_F_MEMS_ALLOWED
+#define MPOL_F_MEMS_ALLOWED (1 << 2)
+#endif
+
+/* Reads the placement settings from the environment. */
+static void initNuma(void)
+{
+    numaPolicy = NUMA_FIRST_TOUCH;
+    char *numaEnv = getenv("SHRAY_NUMA");
+    if (numaEnv != NULL && strcmp(numaEnv, "interleave") == 0) {
+        numaPolicy = NUMA_INTERLEAVE;
+    } else if (numaEnv != NULL && strcmp(numaEnv, "bind") == 0) {
+        numaPolicy = NUMA_BIND;
+    }
+
+    char *prefaultEnv = getenv("SHRAY_PREFAULT");
+    prefault = (prefaultEnv != NULL && atoi(prefaultEnv) != 0);
+
+    memset(numaNodes, 0, sizeof(numaNodes));
+#ifdef SYS_get_mempolicy
+    if (syscall(SYS_get_mempolicy, NULL, numaNodes,
+                8 * sizeof(numaNodes), NULL, MPOL_F_MEMS_ALLOWED) != 0) {
+        numaPolicy = NUMA_FIRST_TOUCH;
+    }
+#else
+    numaPolicy = NUMA_FIRST_TOUCH;
+#endif
+}
+
+/* Sets the NUMA policy of [start, end[, moving pages that are already placed.
+ * Failure only costs performance, so we ignore it. */
+static void numaBind(uintptr_t start, uintptr_t end, int mode,
+        const unsigned long *nodes)
+{
+#ifdef SYS_mbind
+    if (syscall(SYS_mbind, (void *)start, end - start, mode, nodes,
+                8 * sizeof(numaNodes), MPOL_MF_MOVE) != 0) {
+        DBUG_PRINT("mbind of [%p, %p[ failed", (void *)start, (void *)end);
+    }
+#else
+    (void)start;
+    (void)end;
+    (void)mode;
+    (void)nodes;
+#endif
+}
+
+/* Places the part [start, end[ of our partition. With NUMA_BIND, or when
+ * prefaulting, every OpenMP thread handles the pages it would get from a loop
+ * over the partition with a static schedule, so each thread's rows end up on
+ * its own NUMA node. */
+static void placePartition(uintptr_t start, uintptr_t end)
+{
+    if (numaPolicy == NUMA_INTERLEAVE) {
+        numaBind(start, end, MPOL_INTERLEAVE, numaNodes);
+    }
+
+    if (numaPolicy != NUMA_BIND && !prefault) return;
+
+    size_t pages = (end - start) / Shray_Pagesz;
+    size_t systemPage = Shray_Pagesz / Shray_CacheLineSize;
+
+    #pragma omp parallel
+    {
+        size_t threads = omp_get_num_threads();
+        size_t thread = omp_get_thread_num();
+        uintptr_t first = start +
+            splitStart(pages, threads, thread) * Shray_Pagesz;
+        uintptr_t last = start +
+            splitStart(pages, threads, thread + 1) * Shray_Pagesz;
+
+        unsigned int cpu, node;
+        if (numaPolicy == NUMA_BIND && first < last &&
+                syscall(SYS_getcpu, &cpu, &node, NULL) == 0 &&
+                node < 8 * sizeof(numaNodes)) {
+            unsigned long ours[NUMA_MASK_WORDS] = {0};
+            ours[node / (8 * sizeof(unsigned long))] =
+                1ul << node % (8 * sizeof(unsigned long));
+            /* Preferred rather than bound, so a full node does not fail the
+             * allocation. */
+            numaBind(first, last, MPOL_PREFERRED, ours);
+        }
+
+        /* Fresh pages are zero, so writing zero keeps their contents. */
+        if (prefault) {
+            for (uintptr_t page = first; page < last; page += systemPage) {
+                *(volatile char *)page = 0;
+            }
+        }
+    }
+}
+
+/*****************************************************
+ * Sharing pages between ranks on the same host
+ *****************************************************/
+
+/* Finds the ranks that run on our host. */
+static void findHostPeers(void)
+{
+    typedef struct HostInfo {
+        char host[HOSTNAME_LENGTH];
+        pid_t pid;
+    } HostInfo;
+
+    HostInfo *hosts;
+    MALLOC_SAFE(hosts, (Shray_size + 1) * sizeof(HostInfo));
+    HostInfo *ours = hosts + Shray_size;
+    memset(ours, 0, sizeof(HostInfo));
+    snprintf(ours->host, sizeof(ours->host), "%s", ShrayHost);
+    ours->pid = getpid();
+
+    gasnet_coll_gather_all(gasnete_coll_team_all, hosts, ours,
+            sizeof(HostInfo), GASNET_COLL_IN_MYSYNC | GASNET_COLL_OUT_MYSYNC |
+            GASNET_COLL_LOCAL);
+
+    MALLOC_SAFE(hostPids, Shray_size * sizeof(pid_t));
+    hostSharing = false;
+    hostPeers = false;
+    hostLeader = Shray_rank;
+    hostRanks = 1;
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        /* Without a hostname we cannot tell. */
+        bool same = (rank != Shray_rank && ShrayHost[0] != '\0' &&
+                strcmp(hosts[rank].host, ShrayHost) == 0);
+        hostPids[rank] = same ? hosts[rank].pid : 0;
+        hostPeers = hostPeers || same;
+        hostRanks += same;
+        if (same && rank < hostLeader) {
+            hostLeader = rank;
+        }
+        for (unsigned int other = 0; other < rank && !hostSharing; other++) {
+            hostSharing = (hosts[rank].host[0] != '\0' &&
+                    strcmp(hosts[rank].host, hosts[other].host) == 0);
+        }
+    }
+
+    free(hosts);
+}
+
+/* Creates a file of size bytes in memory that other processes can open, or
+ * returns -1. */
+static int createHostFile(size_t size)
+{
+    int fd = -1;
+#ifdef MFD_CLOEXEC
+    fd = memfd_create("shray", MFD_CLOEXEC);
+#endif
+    if (fd == -1) return -1;
+
+    if (ftruncate(fd, size) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+/* Opens file descriptor fd of the process of rank, or returns -1. */
+static int openHostFile(unsigned int rank, int fd, int flags)
+{
+    if (hostPids[rank] == 0 || fd == -1) return -1;
+
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%ld/fd/%d", (long)hostPids[rank], fd);
+    int ours = open(path, flags | O_CLOEXEC);
+    DBUG_PRINT("Opened %s of node %u as %d", path, rank, ours);
+    return ours;
+}
+
+/* Creates a file of size bytes in directory, which is removed once we close
+ * it. */
+static int createDiskFile(const char *directory, size_t size)
+{
+    size_t length = strlen(directory) + sizeof("/shray.XXXXXX");
+    char *path;
+    MALLOC_SAFE(path, length);
+    snprintf(path, length, "%s/shray.XXXXXX", directory);
+
+    int fd = mkostemp(path, O_CLOEXEC);
+    if (fd == -1 || unlink(path) != 0 || ftruncate(fd, size) != 0) {
+        fprintf(stderr, "[node %d]: creating %s: ", Shray_rank, path);
+        perror("");
+        gasnet_exit(1);
+    }
+
+    free(path);
+    return fd;
+}
+
+/* Creates the file that backs our Ar_b if we are asked to keep it in a
+ * directory, or if another rank runs on our host, opens it if it is in the
+ * store, and returns -1 otherwise. */
+static int createPartitionFile(Allocation *alloc,
+        const Distribution *distribution)
+{
+    if (distribution->stored != NULL) {
+        int fd = open(distribution->stored, O_RDWR | O_CLOEXEC);
+        if (fd == -1) {
+            fprintf(stderr, "[node %d]: opening %s: ", Shray_rank,
+                    distribution->stored);
+            perror("");
+            gasnet_exit(1);
+        }
+        return fd;
+    }
+
+    if (distribution->directory != NULL) {
+        return createDiskFile(distribution->directory,
+                roundUpPage(alloc->size));
+    }
+
+    return (hostPeers) ? createHostFile(roundUpPage(alloc->size)) : -1;
+}
+
+/* Maps [start, end[ of our Ar_b read-write, from our partition file if we
+ * have one, and unless that is on disk places it over the NUMA nodes, on huge
+ * pages if asked. */
+static void mapPartition(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    if (alloc->memfd == -1) {
+        MPROTECT_SAFE((void *)start, end - start, PROT_READ | PROT_WRITE);
+    } else {
+        void *success = mmap((void *)start, end - start,
+                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, alloc->memfd,
+                start - alloc->location);
+        if (success == MAP_FAILED) {
+            fprintf(stderr, "[node %d]: ", Shray_rank);
+            perror("mapping our partition failed");
+            gasnet_exit(1);
+        }
+    }
+
+    /* The kernel pages a file in where it is used, and touching it would
+     * write all of it. */
+    if (alloc->onDisk) return;
+
+#ifdef MADV_HUGEPAGE
+    /* Only a hint, the kernel may not support it for this mapping. */
+    if (hugePages) {
+        madvise((void *)start, end - start, MADV_HUGEPAGE);
+    }
+#endif
+
+    placePartition(start, end);
+}
+
+/* Pages that the given number of ranks on our host may cache together of an
+ * array on disk, as their parts of it may be larger than memory: their share
+ * of half the physical memory of our host. The same on every rank of our
+ * host, so they agree on the size of the host cache. */
+static size_t diskCachePages(unsigned int ranks)
+{
+    long physicalPages = sysconf(_SC_PHYS_PAGES);
+    long systemPage = sysconf(_SC_PAGESIZE);
+    if (physicalPages <= 0 || systemPage <= 0) return SIZE_MAX;
+
+    return max(1, (size_t)physicalPages * systemPage / 2 / hostRanks *
+            ranks / Shray_Pagesz);
+}
+
+/* Slots of the host cache of alloc. Like the automatic caches of the ranks on
+ * our host together, SHRAY_CACHEFACTOR times the part of alloc they own, but
+ * at most one per page. */
+static size_t hostSlotCount(Allocation *alloc)
+{
+    size_t pages = roundUp(alloc->size, Shray_Pagesz);
+    size_t share = roundUp(pages * hostRanks, Shray_size);
+    size_t slots = min(pages, max(hostRanks, share * Shray_CacheAllocFactor));
+
+    return alloc->onDisk ? min(slots, diskCachePages(hostRanks)) : slots;
+}
+
+/* Bytes of the host cache file of alloc before the pages of the slots. */
+static size_t hostCacheHeaderBytes(Allocation *alloc)
+{
+    return roundUpPage(sizeof(HostCacheHeader) +
+            roundUp(alloc->size, Shray_Pagesz) * sizeof(size_t) +
+            hostSlotCount(alloc) * sizeof(HostSlot));
+}
+
+static size_t hostCacheBytes(Allocation *alloc)
+{
+    return hostCacheHeaderBytes(alloc) + hostSlotCount(alloc) * Shray_Pagesz;
+}
+
+/* Creates the host cache file of alloc with a lock the ranks on our host can
+ * share, or returns -1. The rest of the file starts out zero, so every page
+ * is in no slot, and every slot is unused. */
+static int createHostCache(Allocation *alloc)
+{
+    int fd = createHostFile(hostCacheBytes(alloc));
+    if (fd == -1) return -1;
+
+    HostCacheHeader *header = mmap(NULL, sizeof(HostCacheHeader),
+            PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (header == MAP_FAILED) {
+        close(fd);
+        return -1;
+    }
+
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+    pthread_mutex_init(&header->lock, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    MUNMAP_SAFE((void *)header, sizeof(HostCacheHeader));
+
+    return fd;
+}
+
+/* Opens the partition files of the ranks on our host, and the host cache the
+ * leader of our host creates. Collective. Ranks whose file we cannot open are
+ * served by gasnet_get as usual. */
+static void openHostFiles(Allocation *alloc)
+{
+    typedef struct HostFiles {
+        int partition;
+        int cache;
+    } HostFiles;
+
+    alloc->hostFds = NULL;
+    alloc->hostCacheFd = -1;
+    alloc->hostCache = NULL;
+    alloc->hostMapped = NULL;
+    if (!hostSharing) return;
+
+    HostFiles *files;
+    MALLOC_SAFE(files, (Shray_size + 1) * sizeof(HostFiles));
+    files[Shray_size].partition = alloc->memfd;
+    files[Shray_size].cache = (hostPeers && hostLeader == Shray_rank) ?
+        createHostCache(alloc) : -1;
+
+    gasnet_coll_gather_all(gasnete_coll_team_all, files, files + Shray_size,
+            sizeof(HostFiles), GASNET_COLL_IN_MYSYNC | GASNET_COLL_OUT_MYSYNC |
+            GASNET_COLL_LOCAL);
+
+    alloc->hostCacheFd = (hostLeader == Shray_rank) ?
+        files[Shray_rank].cache :
+        openHostFile(hostLeader, files[hostLeader].cache, O_RDWR);
+    if (alloc->hostCacheFd != -1) {
+        void *cache = mmap(NULL, hostCacheBytes(alloc), PROT_READ | PROT_WRITE,
+                MAP_SHARED, alloc->hostCacheFd, 0);
+        if (cache == MAP_FAILED) {
+            close(alloc->hostCacheFd);
+            alloc->hostCacheFd = -1;
+        } else {
+            size_t pages = roundUp(alloc->size, Shray_Pagesz);
+            alloc->hostCache = cache;
+            alloc->hostNewest = (size_t *)(alloc->hostCache + 1);
+            alloc->hostSlots = (HostSlot *)(alloc->hostNewest + pages);
+            alloc->hostSlotPages = (char *)cache + hostCacheHeaderBytes(alloc);
+            alloc->numberOfHostSlots = hostSlotCount(alloc);
+            /* Lazily allocated by the OS, like the bitmap. */
+            void *mapped;
+            MMAP_SAFE(mapped, NULL, pages * sizeof(size_t),
+                    PROT_READ | PROT_WRITE);
+            alloc->hostMapped = mapped;
+        }
+    }
+
+    MALLOC_SAFE(alloc->hostFds, Shray_size * sizeof(int));
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        alloc->hostFds[rank] = openHostFile(rank, files[rank].partition,
+                O_RDONLY);
+    }
+
+    free(files);
+}
+
+/* Closes the files opened by createPartitionFile and openHostFiles. */
+static void closeHostFiles(Allocation *alloc)
+{
+    if (alloc->memfd != -1) {
+        close(alloc->memfd);
+    }
+
+    if (alloc->hostFds != NULL) {
+        for (unsigned int rank = 0; rank < Shray_size; rank++) {
+            if (alloc->hostFds[rank] != -1) {
+                close(alloc->hostFds[rank]);
+            }
+        }
+        free(alloc->hostFds);
+    }
+
+    if (alloc->hostCache != NULL) {
+        MUNMAP_SAFE((void *)alloc->hostCache, hostCacheBytes(alloc));
+        MUNMAP_SAFE((void *)alloc->hostMapped,
+                roundUp(alloc->size, Shray_Pagesz) * sizeof(size_t));
+        close(alloc->hostCacheFd);
+    }
+}
+
+/*****************************************************
+ * Shray functionality
+ *****************************************************/
+
+void ShrayInit(int *argc, char ***argv)
+{
+    GASNET_SAFE(gasnet_init(argc, argv));
+    /* Must be built with GASNET_SEGMENT_EVERYTHING, so these arguments are
+     * ignored. */
+    gasnet_handlerentry_t handlers[] = {
+        {HANDLER_UPDATE, (void (*)())UpdateHandler},
+        {HANDLER_UPDATE_ACK, (void (*)())UpdateAckHandler},
+        {HANDLER_RING, (void (*)())RingHandler},
+    };
+    GASNET_SAFE(gasnet_attach(handlers,
+                sizeof(handlers) / sizeof(gasnet_handlerentry_t), 4096, 0));
+
+    Shray_size = gasnet_nodes();
+    Shray_rank = gasnet_mynode();
+
+    ShrayOutput = (Shray_rank == 0);
+
+    Shray_SegfaultCounter = 0;
+    Shray_BarrierCounter = 0;
+    Shray_FetchedBytes = 0;
+    Shray_DeltaSavedBytes = 0;
+
+    if(gethostname(ShrayHost, HOSTNAME_LENGTH) != 0) {
+        ShrayHost[0] = '\0';
+    }
+    findHostPeers();
+
+    char *cacheLineEnv = getenv("SHRAY_CACHELINE");
+    if (cacheLineEnv == NULL) {
+        Shray_CacheLineSize = 1;
+    } else {
+        Shray_CacheLineSize = atol(cacheLineEnv);
+    }
+
+    int pagesz = sysconf(_SC_PAGE_SIZE);
+    if (pagesz == -1) {
+        perror("Querying system page size failed.");
+    }
+
+    Shray_Pagesz = (size_t)pagesz * Shray_CacheLineSize;
+
+    /* SHRAY_NUMA=interleave spreads our partitions over the NUMA nodes,
+     * SHRAY_NUMA=bind places the rows of each OpenMP thread on its node.
+     * SHRAY_PREFAULT=1 touches our partitions at allocation. */
+    initNuma();
+
+    /* SHRAY_HUGEPAGES=1 asks for transparent huge pages for our partitions,
+     * and if SHRAY_CACHELINE makes Shray_Pagesz a multiple of 2 MiB, for huge
+     * pages from the pool for remote data. */
+    char *hugePagesEnv = getenv("SHRAY_HUGEPAGES");
+    hugePages = (hugePagesEnv != NULL && atoi(hugePagesEnv) != 0);
+    hugeShadowPages = hugePages && Shray_Pagesz % HUGE_PAGE_SIZE == 0;
+
+    /* SHRAY_DELTA=1 lets a node that cached a page in the previous epoch
+     * refetch only the parts that changed, at the cost of a copy of every
+     * partition. */
+    char *deltaEnv = getenv("SHRAY_DELTA");
+    deltaRefetch = (deltaEnv != NULL && atoi(deltaEnv) != 0);
+
+    /* SHRAY_ASYNCCHECKPOINT=1 makes ShrayCheckpoint return after copying our
+     * part of the array, and write it in the background. */
+    char *asyncCheckpointEnv = getenv("SHRAY_ASYNCCHECKPOINT");
+    asyncCheckpoints = (asyncCheckpointEnv != NULL &&
+            atoi(asyncCheckpointEnv) != 0);
+    checkpoint.path = NULL;
+
+    /* SHRAY_STORE is the directory ShrayStore keeps arrays in, which should
+     * be in memory, and is the same for all jobs that share them. */
+    storeDirectory = getenv("SHRAY_STORE");
+    if (storeDirectory == NULL) {
+        storeDirectory = "/dev/shm";
+    }
+
+    heap.size = sizeof(Allocation);
+    heap.numberOfAllocs = 0;
+    MALLOC_SAFE(heap.allocs, sizeof(Allocation));
+    reserveHeap();
+
+    MALLOC_SAFE(updateBuffers, Shray_size * sizeof(char *));
+    MALLOC_SAFE(updateFill, Shray_size * sizeof(size_t));
+    MALLOC_SAFE(updateLast, Shray_size * sizeof(size_t));
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        updateBuffers[rank] = NULL;
+        updateFill[rank] = 0;
+        updateLast[rank] = NO_RECORD;
+    }
+    updatesInFlight = 0;
+
+    MALLOC_SAFE(pagePushes, Shray_size * sizeof(size_t));
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        pagePushes[rank] = 0;
+    }
+    pagePush = 0;
+
+    char *cacheSizeEnv = getenv("SHRAY_CACHEFACTOR");
+    if (cacheSizeEnv == NULL) {
+        Shray_CacheAllocFactor = 1;
+    } else {
+        Shray_CacheAllocFactor = strtod(cacheSizeEnv, NULL);
+    }
+
+    registerHandlers();
+}
+
+/* Sets up the bookkeeping for refetching only the changed parts of pages, see
+ * SHRAY_DELTA. */
+static void allocateDeltas(Allocation *alloc)
+{
+    size_t pages = alloc->local->size;
+
+    /* At the same address on every node, so others can get it. */
+    alloc->deltas = (PageDelta *)takeChunk(pages * sizeof(PageDelta));
+    MPROTECT_SAFE((void *)alloc->deltas, roundUpPage(pages * sizeof(PageDelta)),
+            PROT_READ | PROT_WRITE);
+
+    /* Lazily allocated by the OS, we only touch the pages of our partitions
+     * and the remote pages we cache. */
+    void *previous;
+    MMAP_SAFE(previous, NULL, pages * Shray_Pagesz, PROT_READ | PROT_WRITE);
+    alloc->previous = previous;
+
+    alloc->retained = BitmapCreate(pages);
+    void *epochs;
+    MMAP_SAFE(epochs, NULL, pages * sizeof(size_t), PROT_READ | PROT_WRITE);
+    alloc->retainedEpochs = epochs;
+    MMAP_SAFE(epochs, NULL, pages * sizeof(size_t), PROT_READ | PROT_WRITE);
+    alloc->fetchEpochs = epochs;
+}
+
+static void freeDeltas(Allocation *alloc)
+{
+    size_t pages = alloc->local->size;
+
+    returnChunk((uintptr_t)alloc->deltas, pages * sizeof(PageDelta), true);
+    MUNMAP_SAFE(alloc->previous, pages * Shray_Pagesz);
+    BitmapFree(alloc->retained);
+    MUNMAP_SAFE((void *)alloc->retainedEpochs, pages * sizeof(size_t));
+    alloc->deltas = NULL;
+}
+
+/* Creates the allocation on this node, the caller holds the lock and has to
+ * call gasnetBarrier before the allocation may be used. A NULL distribution
+ * gives every rank a block of roundUp(firstDimension, Shray_size) rows. */
+static Allocation *allocate(size_t firstDimension, size_t totalSize,
+        const Distribution *distribution)
+{
+    static const Distribution blockwise = {0};
+    if (distribution == NULL) {
+        distribution = &blockwise;
+    }
+
+    /* Every node allocates and frees in the same order, so this is the same
+     * address everywhere. */
+    void *location = (void *)takeChunk(totalSize);
+
+    /* Insert allocation into the heap, making sure allocs stays sorted. */
+    heap.numberOfAllocs++;
+    if (heap.numberOfAllocs > heap.size / sizeof(Allocation)) {
+        REALLOC_SAFE(heap.allocs, 2 * heap.size);
+        heap.size *= 2;
+    }
+    int index = heap.numberOfAllocs - 1;
+    while (index > 0 && heap.allocs[index - 1].location > (uintptr_t)location) {
+        heap.allocs[index] = heap.allocs[index - 1];
+        index--;
+    }
+
+    Allocation *alloc = heap.allocs + index;
+
+    /* We distribute blockwise over the first dimension. */
+    const size_t *splitPoints = distribution->splitPoints;
+    alloc->blockRows = distribution->blockRows;
+    alloc->columns = distribution->columns;
+    alloc->gridRows = distribution->gridRows;
+    alloc->gridCols = distribution->gridCols;
+    alloc->haloRows = distribution->haloRows;
+    alloc->replicated = distribution->replicated;
+    alloc->splitPoints = NULL;
+    if (alloc->blockRows == 0 && alloc->gridCols == 0) {
+        MALLOC_SAFE(alloc->splitPoints, (Shray_size + 1) * sizeof(size_t));
+        size_t rowsPerBlock = roundUp(firstDimension, Shray_size);
+        for (unsigned int rank = 0; rank <= Shray_size; rank++) {
+            alloc->splitPoints[rank] = (splitPoints == NULL) ?
+                min(rank * rowsPerBlock, firstDimension) : splitPoints[rank];
+        }
+    }
+
+    alloc->firstDimension = firstDimension;
     alloc->location = (uintptr_t)location;
     alloc->size = totalSize;
-    alloc->bytesPerBlock = bytesPerBlock;
-
-    size_t segmentLength = endRead(alloc, Shray_rank) -
-                           startRead(alloc, Shray_rank);
-
-    DBUG_PRINT("Made a DSM allocation [%p, %p[, of which \t\tAw = [%p, %p[, "
-            "\t\tAr = [%p, %p[,\t\tAp = [%p, %p[.",
-            location, (void *)((uintptr_t)location + totalSize),
-            (void *)startWrite(alloc, Shray_rank),
-            (void *)endWrite(alloc, Shray_rank),
-            (void *)startRead(alloc, Shray_rank),
-            (void *)endRead(alloc, Shray_rank),
-            (void *)startPartition(alloc, Shray_rank),
-            (void *)endPartition(alloc, Shray_rank));
-
-    MPROTECT_SAFE((void *)startRead(alloc, Shray_rank), segmentLength,
+    alloc->bytesPerRow = totalSize / firstDimension;
+    alloc->maxStaleness = 0;
+    alloc->epoch = 0;
+    alloc->fetchEpochs = NULL;
+    alloc->multiWriter = false;
+    alloc->remoteUpdates = false;
+    alloc->twinned = NULL;
+    alloc->twins = NULL;
+    alloc->numberOfTwins = 0;
+    alloc->twinsSize = 0;
+
+    alloc->onDisk = (distribution->directory != NULL ||
+            distribution->stored != NULL);
+    alloc->memfd = (hostSharing || alloc->onDisk) ?
+        createPartitionFile(alloc, distribution) : -1;
+
+    size_t segmentLength = 0;
+    size_t blocks = numberOfBlocks(alloc);
+
+    for (size_t block = firstLocalBlock(alloc, alloc->location);
+            block < blocks; block = nextLocalBlock(alloc, block)) {
+        segmentLength += endRead(alloc, block) - startRead(alloc, block);
+
+        DBUG_PRINT("Made a DSM allocation [%p, %p[, of which block %zu has "
+                "\t\tAw = [%p, %p[, \t\tAr = [%p, %p[,\t\tAp = [%p, %p[.",
+                location, (void *)((uintptr_t)location + totalSize), block,
+                (void *)startWrite(alloc, block),
+                (void *)endWrite(alloc, block),
+                (void *)startRead(alloc, block),
+                (void *)endRead(alloc, block),
+                (void *)startPartition(alloc, block),
+                (void *)endPartition(alloc, block));
+
+        mapPartition(alloc, startRead(alloc, block), endRead(alloc, block));
+    }
+
+    openHostFiles(alloc);
+
+    alloc->local = BitmapCreate(roundUp(totalSize, Shray_Pagesz));
+
+    /* At the same address on every node, so owners can put into it. Fresh
+     * memory is zero, so every page starts out all zero. */
+    alloc->dataPages = (uint8_t *)takeChunk(alloc->local->size);
+    MPROTECT_SAFE(alloc->dataPages, roundUpPage(alloc->local->size),
             PROT_READ | PROT_WRITE);
 
-    alloc->local = BitmapCreate(roundUp(totalSize, Shray_Pagesz));
+    /* A copy in memory would defeat keeping a partition on disk. */
+    alloc->deltas = NULL;
+    if (deltaRefetch && !alloc->replicated && !alloc->onDisk) {
+        allocateDeltas(alloc);
+    }
+
+    /* A node without rows of its own still has to cache remote pages. */
+    size_t cacheEntries = max(1, segmentLength / Shray_Pagesz *
+                                            Shray_CacheAllocFactor);
+    if (alloc->onDisk) {
+        cacheEntries = min(cacheEntries, diskCachePages(1));
+    }
+    alloc->autoCaches = ringbuffer_alloc(cacheEntries);
+    if (!alloc->autoCaches) {
+        fprintf(stderr, "[node %d]: Could not allocate autocache", Shray_rank);
+        gasnet_exit(1);
+    }
+    DBUG_PRINT("Allocated %zu automatic cache entries (%zu)", cacheEntries,
+            totalSize / Shray_Pagesz);
+
+    return alloc;
+}
+
+void *ShrayMalloc(size_t firstDimension, size_t totalSize)
+{
+    lock();
+
+    /* All nodes share the pages of small arrays anyway. */
+    Distribution distribution = {
+        .replicated = (totalSize <= REPLICATED_PAGES * Shray_Pagesz)
+    };
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocReplicated(size_t firstDimension, size_t totalSize)
+{
+    lock();
+
+    Distribution distribution = {.replicated = true};
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocFile(size_t firstDimension, size_t totalSize,
+        const char *directory)
+{
+    lock();
+
+    Distribution distribution = {.directory = directory};
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+/* Lets cached pages of alloc survive maxStaleness ShraySyncs, see
+ * ShrayMallocStale. */
+static void makeStale(Allocation *alloc, unsigned int maxStaleness)
+{
+    alloc->maxStaleness = maxStaleness;
+    /* We only keep copies of cached pages at exact consistency. */
+    if (maxStaleness > 0 && alloc->deltas != NULL) {
+        freeDeltas(alloc);
+    }
+    if (maxStaleness > 0 && alloc->fetchEpochs == NULL) {
+        /* Lazily allocated by the OS, like the bitmap. */
+        void *fetchEpochs;
+        MMAP_SAFE(fetchEpochs, NULL, alloc->local->size * sizeof(size_t),
+                PROT_READ | PROT_WRITE);
+        alloc->fetchEpochs = fetchEpochs;
+    }
+}
+
+/* Lets every node write to all of alloc, see ShrayMallocMultiWriter. */
+static void makeMultiWriter(Allocation *alloc)
+{
+    alloc->multiWriter = true;
+    alloc->remoteUpdates = true;
+    /* Remote writes are merged into pages by other nodes. */
+    if (alloc->deltas != NULL) {
+        freeDeltas(alloc);
+    }
+    alloc->twinned = BitmapCreate(alloc->local->size);
+    twinBoundaryPages(alloc);
+}
+
+void *ShrayMallocStale(size_t firstDimension, size_t totalSize,
+        unsigned int maxStaleness)
+{
+    lock();
+
+    Allocation *alloc = allocate(firstDimension, totalSize, NULL);
+    void *location = (void *)alloc->location;
+    makeStale(alloc, maxStaleness);
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocMultiWriter(size_t firstDimension, size_t totalSize)
+{
+    lock();
+
+    Allocation *alloc = allocate(firstDimension, totalSize, NULL);
+    void *location = (void *)alloc->location;
+    makeMultiWriter(alloc);
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocSplit(size_t firstDimension, size_t totalSize,
+        const size_t *splitPoints)
+{
+    lock();
+
+    size_t *balanced = NULL;
+    if (splitPoints == NULL) {
+        /* Rank r gets floor(n / p) or ceil(n / p) rows. */
+        MALLOC_SAFE(balanced, (Shray_size + 1) * sizeof(size_t));
+        for (unsigned int rank = 0; rank <= Shray_size; rank++) {
+            balanced[rank] = rank * firstDimension / Shray_size;
+        }
+        splitPoints = balanced;
+    } else if (splitPoints[0] != 0 ||
+            splitPoints[Shray_size] != firstDimension) {
+        fprintf(stderr, "[node %d]: ShrayMallocSplit: split points should run "
+                "from 0 to %zu\n", Shray_rank, firstDimension);
+        gasnet_exit(1);
+    } else {
+        for (unsigned int rank = 0; rank < Shray_size; rank++) {
+            if (splitPoints[rank] > splitPoints[rank + 1]) {
+                fprintf(stderr, "[node %d]: ShrayMallocSplit: split points "
+                        "should be non-decreasing\n", Shray_rank);
+                gasnet_exit(1);
+            }
+        }
+    }
+
+    Distribution distribution = {.splitPoints = splitPoints};
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+    free(balanced);
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocAligned(size_t firstDimension, size_t totalSize)
+{
+    lock();
+
+    /* Blocks of a multiple of rowsPerPage rows start on a page. */
+    size_t rowsPerPage = Shray_Pagesz /
+        gcd(Shray_Pagesz, totalSize / firstDimension);
+
+    /* With fewer than rowsPerPage rows per node, rounding leaves most nodes
+     * without rows, so we keep the balanced split and share pages. */
+    bool aligned = rowsPerPage * Shray_size <= firstDimension;
+    if (!aligned && Shray_rank == 0) {
+        fprintf(stderr, "[node %d]: ShrayMallocAligned: %zu rows are too few "
+                "to give %u nodes %zu rows each, falling back to a balanced "
+                "split\n", Shray_rank, firstDimension, Shray_size,
+                rowsPerPage);
+    }
+
+    /* The balanced split, rounded to the nearest multiple of rowsPerPage. */
+    size_t *splitPoints;
+    MALLOC_SAFE(splitPoints, (Shray_size + 1) * sizeof(size_t));
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        size_t row = rank * firstDimension / Shray_size;
+        splitPoints[rank] = aligned ? min((row + rowsPerPage / 2) /
+                rowsPerPage * rowsPerPage, firstDimension) : row;
+    }
+    splitPoints[Shray_size] = firstDimension;
+
+    Distribution distribution = {.splitPoints = splitPoints};
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+    free(splitPoints);
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocHalo(size_t firstDimension, size_t totalSize,
+        size_t haloRows)
+{
+    lock();
+
+    Distribution distribution = {.haloRows = haloRows};
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+void *ShrayMallocCyclic(size_t firstDimension, size_t totalSize,
+        size_t blockRows)
+{
+    lock();
+
+    if (blockRows == 0) {
+        fprintf(stderr, "[node %d]: ShrayMallocCyclic: blockRows should be "
+                "positive\n", Shray_rank);
+        gasnet_exit(1);
+    }
+
+    Distribution distribution = {.blockRows = blockRows};
+    void *location = (void *)allocate(firstDimension, totalSize,
+            &distribution)->location;
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+/* The most square process grid of Shray_size nodes. */
+static void squareGrid(unsigned int *gridRows, unsigned int *gridCols)
+{
+    unsigned int rows;
+    for (rows = 1; (rows + 1) * (rows + 1) <= Shray_size; rows++);
+    while (Shray_size % rows != 0) rows--;
+
+    *gridRows = rows;
+    *gridCols = Shray_size / rows;
+}
+
+void *ShrayMalloc2D(size_t rows, size_t columns, size_t elementSize,
+        unsigned int gridRows, unsigned int gridCols)
+{
+    lock();
+
+    if (gridRows == 0 && gridCols == 0) {
+        squareGrid(&gridRows, &gridCols);
+    }
+
+    if (gridRows * gridCols != Shray_size) {
+        fprintf(stderr, "[node %d]: ShrayMalloc2D: a %u x %u grid does not "
+                "have %u nodes\n", Shray_rank, gridRows, gridCols,
+                Shray_size);
+        gasnet_exit(1);
+    }
+
+    Distribution distribution = {.columns = columns, .gridRows = gridRows,
+        .gridCols = gridCols};
+    void *location = (void *)allocate(rows, rows * columns * elementSize,
+            &distribution)->location;
+
+    gasnetBarrier();
+
+    unlock();
+    return location;
+}
+
+/* Exits if we own more than one block of alloc. */
+static void checkSingleBlock(Allocation *alloc, const char *caller)
+{
+    if (isTiled(alloc)) {
+        fprintf(stderr, "[node %d]: %s: array is tiled, use ShrayTile\n",
+                Shray_rank, caller);
+        gasnet_exit(1);
+    }
+    if (numberOfBlocks(alloc) > Shray_size) {
+        fprintf(stderr, "[node %d]: %s: array is block-cyclic, use "
+                "ShrayLocalBlock\n", Shray_rank, caller);
+        gasnet_exit(1);
+    }
+}
+
+size_t ShrayStart(void *array)
+{
+    Allocation *alloc = findAlloc(array);
+    checkSingleBlock(alloc, "ShrayStart");
+    return blockStart(alloc, Shray_rank);
+}
+
+size_t ShrayEnd(void *array)
+{
+    Allocation *alloc = findAlloc(array);
+    checkSingleBlock(alloc, "ShrayEnd");
+    return blockStart(alloc, Shray_rank + 1);
+}
+
+bool ShrayLocalBlock(void *array, size_t k, size_t *start, size_t *end)
+{
+    Allocation *alloc = findAlloc(array);
+    size_t block = Shray_rank + k * Shray_size;
+
+    if (isTiled(alloc)) {
+        fprintf(stderr, "[node %d]: ShrayLocalBlock: array is tiled, use "
+                "ShrayTile\n", Shray_rank);
+        gasnet_exit(1);
+    }
+
+    if (block >= numberOfBlocks(alloc)) return false;
+
+    *start = blockStart(alloc, block);
+    *end = blockStart(alloc, block + 1);
+    return true;
+}
+
+void ShrayTile(void *array, size_t *rowStart, size_t *rowEnd,
+        size_t *columnStart, size_t *columnEnd)
+{
+    Allocation *alloc = findAlloc(array);
+
+    if (!isTiled(alloc)) {
+        fprintf(stderr, "[node %d]: ShrayTile: array was not allocated by "
+                "ShrayMalloc2D\n", Shray_rank);
+        gasnet_exit(1);
+    }
+
+    size_t gridRow = Shray_rank / alloc->gridCols;
+    size_t gridCol = Shray_rank % alloc->gridCols;
+    *rowStart = splitStart(alloc->firstDimension, alloc->gridRows, gridRow);
+    *rowEnd = splitStart(alloc->firstDimension, alloc->gridRows, gridRow + 1);
+    *columnStart = splitStart(alloc->columns, alloc->gridCols, gridCol);
+    *columnEnd = splitStart(alloc->columns, alloc->gridCols, gridCol + 1);
+}
+
+/* Sends [start, end[ to rank, unless this push already did. Returns the
+ * number of nodes this push has sent to. The put completes at the
+ * gasnet_wait_syncnbi_puts after publish. */
+static unsigned int pushPagePart(unsigned int rank, uintptr_t start,
+        uintptr_t end, unsigned int sent)
+{
+    if (rank == Shray_rank || pagePushes[rank] == pagePush) return sent;
+
+    DBUG_PRINT("Put [%p, %p[ into node %u", (void *)start, (void *)end, rank);
+    gasnet_put_nbi_bulk(rank, (void *)start, (void *)start, end - start);
+    pagePushes[rank] = pagePush;
+    return sent + 1;
+}
+
+/* Sends Aw_b \cap [from, to[ to the owners of the blocks c < b that store
+ * part of it, that is Aw_b \cap Ar_c. Without a halo this is part of the first
+ * page of Ar_b. */
+static void UpdateLeftPage(Allocation *alloc, size_t block, uintptr_t from,
+        uintptr_t to)
+{
+    uintptr_t start = max(startWrite(alloc, block), from);
+    uintptr_t writeEnd = min(endWrite(alloc, block), to);
+
+    if (start >= writeEnd) return;
+
+    /* The nearest block of a node has the largest intersection. */
+    pagePush++;
+    unsigned int sent = 0;
+    for (size_t other = block; other > 0 && sent < Shray_size - 1; other--) {
+        uintptr_t end = min(writeEnd, endRead(alloc, other - 1));
+        if (end <= start) break;
+        sent = pushPagePart(blockOwner(alloc, other - 1), start, end, sent);
+    }
+}
+
+/* Sends Aw_b \cap [from, to[ to the owners of the blocks c > b that store
+ * part of it, that is Aw_b \cap Ar_c. Without a halo this is part of the last
+ * page of Ar_b. */
+static void UpdateRightPage(Allocation *alloc, size_t block, uintptr_t from,
+        uintptr_t to)
+{
+    uintptr_t writeStart = max(startWrite(alloc, block), from);
+    uintptr_t end = min(endWrite(alloc, block), to);
+
+    if (writeStart >= end) return;
+
+    pagePush++;
+    unsigned int sent = 0;
+    size_t blocks = numberOfBlocks(alloc);
+    for (size_t other = block + 1; other < blocks && sent < Shray_size - 1;
+            other++) {
+        uintptr_t start = max(writeStart, startRead(alloc, other));
+        if (start >= end) break;
+        sent = pushPagePart(blockOwner(alloc, other), start, end, sent);
+    }
+}
+
+/* Replicated allocations are stored completely on every node, so we sync them
+ * by gathering the blocks of all nodes. */
+static void gatherReplicated(Allocation *alloc)
+{
+    size_t blockSize = 0;
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        blockSize = max(blockSize,
+                endWrite(alloc, rank) - startWrite(alloc, rank));
+    }
+
+    if (blockSize == 0) return;
+
+    /* The blocks of all nodes, padded to blockSize, and then ours. */
+    char *blocks;
+    MALLOC_SAFE(blocks, (Shray_size + 1) * blockSize);
+    char *ours = blocks + Shray_size * blockSize;
+    memcpy(ours, (void *)startWrite(alloc, Shray_rank),
+            endWrite(alloc, Shray_rank) - startWrite(alloc, Shray_rank));
+
+    gasnet_coll_gather_all(gasnete_coll_team_all, blocks, ours, blockSize,
+            GASNET_COLL_IN_MYSYNC | GASNET_COLL_OUT_MYSYNC | GASNET_COLL_LOCAL);
+
+    for (unsigned int rank = 0; rank < Shray_size; rank++) {
+        if (rank == Shray_rank) continue;
+        memcpy((void *)startWrite(alloc, rank), blocks + rank * blockSize,
+                endWrite(alloc, rank) - startWrite(alloc, rank));
+    }
+
+    free(blocks);
+}
+
+/* Puts [start, end[ into every other node. Node r starts with node r + 1 to
+ * spread the targets, but all P - 1 puts are in flight at once, so use this
+ * for small ranges only, see ringAllgather. */
+static void pushToAll(uintptr_t start, uintptr_t end)
+{
+    if (start >= end) return;
+
+    for (unsigned int i = 1; i < Shray_size; i++) {
+        unsigned int rank = (Shray_rank + i) % Shray_size;
+        DBUG_PRINT("Put [%p, %p[ into node %u", (void *)start, (void *)end,
+                rank);
+        gasnet_put_nbi_bulk(rank, (void *)start, (void *)start, end - start);
+    }
+}
+
+/* Number of pieces ringAllgather puts the blocks of node owner in [start,
+ * end[ in. */
+static size_t ringPieces(Allocation *alloc, unsigned int owner,
+        uintptr_t start, uintptr_t end)
+{
+    size_t blocks = numberOfBlocks(alloc);
+    size_t pieces = 0;
+
+    for (size_t block = findBlock(alloc, start);
+            block < blocks && startWrite(alloc, block) < end; block++) {
+        if (blockOwner(alloc, block) != owner) continue;
+        uintptr_t from = max(startWrite(alloc, block), start);
+        uintptr_t to = min(endWrite(alloc, block), end);
+        if (from >= to) continue;
+        pieces += roundUp(to - from, RING_CHUNK);
+    }
+
+    return pieces;
+}
+
+/* Waits for put, of a ringAllgather piece into node next, to complete, and
+ * tells next it has arrived. */
+static void ringSignal(unsigned int next, gasnet_handle_t put)
+{
+    gasnet_wait_syncnb(put);
+    GASNET_SAFE(gasnet_AMRequestShort0(next, HANDLER_RING));
+}
+
+/* Gives every node the parts of [start, end[ in the Aw_b of all nodes. In
+ * step i, node r puts the blocks of node r + 1 - i, which it got in the step
+ * before, into node r + 1. So each node sends to and receives from one node
+ * at a time, and (P - 1) / P of the range in total. The blocks go in pieces
+ * of RING_CHUNK bytes, after each of which we signal node r + 1 only. A node
+ * forwards a piece as soon as it has arrived, so all steps overlap. Collective,
+ * the puts have arrived on return. */
+static void ringAllgather(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    size_t blocks = numberOfBlocks(alloc);
+    unsigned int next = (Shray_rank + 1) % Shray_size;
+    /* Put of the last piece, which we have not signalled yet if sent. A
+     * completed put may return GASNET_INVALID_HANDLE, so we need both. */
+    gasnet_handle_t pending = GASNET_INVALID_HANDLE;
+    bool sent = false;
+    size_t forwarded = 0;
+
+    if (Shray_size == 1) return;
+
+    for (unsigned int step = 1; step < Shray_size; step++) {
+        unsigned int source = (Shray_rank + Shray_size + 1 - step) %
+            Shray_size;
+        for (size_t block = findBlock(alloc, start);
+                block < blocks && startWrite(alloc, block) < end; block++) {
+            if (blockOwner(alloc, block) != source) continue;
+            uintptr_t from = max(startWrite(alloc, block), start);
+            uintptr_t to = min(endWrite(alloc, block), end);
+
+            for (uintptr_t piece = from; piece < to; piece += RING_CHUNK) {
+                size_t size = min(to - piece, RING_CHUNK);
+
+                /* The previous node sends us the pieces we forward after
+                 * step 1 in the same order, one step earlier. */
+                if (step > 1) {
+                    forwarded++;
+                    /* Node r + 1 may be waiting for our last piece. */
+                    if (sent && __atomic_load_n(&ringArrived,
+                                __ATOMIC_SEQ_CST) < forwarded) {
+                        ringSignal(next, pending);
+                        sent = false;
+                    }
+                    GASNET_BLOCKUNTIL(__atomic_load_n(&ringArrived,
+                                __ATOMIC_SEQ_CST) >= forwarded);
+                }
+
+                DBUG_PRINT("Put [%p, %p[ of node %u into node %u",
+                        (void *)piece, (void *)(piece + size), source, next);
+                gasnet_handle_t handle = gasnet_put_nb_bulk(next,
+                        (void *)piece, (void *)piece, size);
+
+                /* Signal the previous piece once it is there, keeping one
+                 * put in flight. */
+                if (sent) ringSignal(next, pending);
+                pending = handle;
+                sent = true;
+            }
+        }
+    }
+
+    if (sent) ringSignal(next, pending);
+
+    /* The blocks of node r + 1 are the last we get, and do not pass on. */
+    size_t total = forwarded + ringPieces(alloc, next, start, end);
+    GASNET_BLOCKUNTIL(__atomic_load_n(&ringArrived, __ATOMIC_SEQ_CST) >=
+            total);
+    __atomic_fetch_sub(&ringArrived, total, __ATOMIC_SEQ_CST);
+
+    /* So no node puts the blocks of its next ShraySync into a node that is
+     * still reading these. */
+    gasnetBarrier();
+}
+
+/* Sets inUse[k] if system page k of [start, end[ is present or swapped out,
+ * according to /proc/self/pagemap. Other pages were never touched, and are
+ * zero. Returns false if we cannot tell. mincore(2) will not do, it does not
+ * count swapped pages. */
+static bool pagesInUse(uintptr_t start, uintptr_t end, unsigned char *inUse)
+{
+    size_t systemPage = Shray_Pagesz / Shray_CacheLineSize;
+    size_t count = (end - start) / systemPage;
+
+    int fd = open("/proc/self/pagemap", O_RDONLY);
+    if (fd == -1) return false;
+
+    uint64_t *entries;
+    MALLOC_SAFE(entries, count * sizeof(uint64_t));
+    ssize_t bytes = count * sizeof(uint64_t);
+    bool known = (pread(fd, entries, bytes,
+                start / systemPage * sizeof(uint64_t)) == bytes);
+    close(fd);
+
+    /* Bit 63 is present, bit 62 swapped. */
+    for (size_t k = 0; known && k < count; k++) {
+        inUse[k] = (entries[k] >> 62) != 0;
+    }
+    free(entries);
+
+    return known;
+}
+
+/* Like pagesInUse, for the pages of alloc that map its partition file: sets
+ * inUse[k] unless system page k of [start, end[ lies in a hole of the file.
+ * Unlike reading them, this does not allocate holes on tmpfs or read the file
+ * back from disk. Swapped and written back pages count as data. */
+static bool fileInUse(Allocation *alloc, uintptr_t start, uintptr_t end,
+        unsigned char *inUse)
+{
+#ifdef SEEK_DATA
+    size_t systemPage = Shray_Pagesz / Shray_CacheLineSize;
+    off_t first = start - alloc->location;
+    off_t last = end - alloc->location;
+
+    memset(inUse, 0, (end - start) / systemPage);
+    off_t data = first;
+    while (data < last) {
+        data = lseek(alloc->memfd, data, SEEK_DATA);
+        /* ENXIO: there is no data after data. */
+        if (data == -1) return errno == ENXIO;
+        if (data >= last) break;
+
+        off_t hole = lseek(alloc->memfd, data, SEEK_HOLE);
+        if (hole == -1) return false;
+        hole = min(hole, last);
+
+        size_t from = (data - first) / systemPage;
+        size_t to = roundUp(hole - first, systemPage);
+        memset(inUse + from, 1, to - from);
+        data = hole;
+    }
+
+    return true;
+#else
+    (void)alloc;
+    (void)start;
+    (void)end;
+    (void)inUse;
+    return false;
+#endif
+}
+
+/* True if the page at page is all zero. inUse is the pagesInUse vector of its
+ * system pages, pages we never touched are zero without reading them. */
+static bool allZero(uintptr_t page, const unsigned char *inUse)
+{
+    size_t systemPage = Shray_Pagesz / Shray_CacheLineSize;
+
+    for (size_t k = 0; k < Shray_CacheLineSize; k++) {
+        if (!inUse[k]) continue;
+        const uint64_t *words = (const uint64_t *)(page + k * systemPage);
+        for (size_t i = 0; i < systemPage / sizeof(uint64_t); i++) {
+            if (words[i] != 0) return false;
+        }
+    }
+
+    return true;
+}
+
+/* Sets [*first, *last[ to the pages intersecting [start, end[ that lie within
+ * Aw_b of block, so no other node writes to them, see isOwnedPage. */
+static void ownedPages(Allocation *alloc, size_t block, uintptr_t start,
+        uintptr_t end, uintptr_t *first, uintptr_t *last)
+{
+    uintptr_t blockEnd = endWrite(alloc, block);
+
+    *first = max(roundUpPage(startWrite(alloc, block)), roundDownPage(start));
+    *last = min((blockEnd == alloc->location + alloc->size) ?
+            roundUpPage(blockEnd) : roundDownPage(blockEnd), roundUpPage(end));
+}
+
+/* Checks which of our pages in [start, end[ that were all zero still are,
+ * and sends the ones that got data to the other nodes. Pages only go from
+ * zero to data, so a page is not read again once it has data. We only
+ * consider pages within one of our Aw_b, as no one else writes to those. */
+static void publishZeroPages(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    size_t systemPage = Shray_Pagesz / Shray_CacheLineSize;
+    size_t blocks = numberOfBlocks(alloc);
+
+    for (size_t block = firstLocalBlock(alloc, start);
+            block < blocks && startWrite(alloc, block) < end;
+            block = nextLocalBlock(alloc, block)) {
+        uintptr_t first, last;
+        ownedPages(alloc, block, start, end, &first, &last);
+
+        unsigned char *inUse = NULL;
+        size_t changedFirst = SIZE_MAX;
+        size_t changedLast = 0;
+        for (uintptr_t page = first; page < last; page += Shray_Pagesz) {
+            size_t index = (page - alloc->location) / Shray_Pagesz;
+            if (alloc->dataPages[index] != 0) continue;
+
+            if (inUse == NULL) {
+                MALLOC_SAFE(inUse, (last - first) / systemPage);
+                /* Older kernels do not report swapped pages of a file in
+                 * pagemap, so for those we ask the file. */
+                bool known = (alloc->memfd != -1) ?
+                    fileInUse(alloc, first, last, inUse) :
+                    pagesInUse(first, last, inUse);
+                if (!known) {
+                    memset(inUse, 1, (last - first) / systemPage);
+                }
+            }
+
+            if (!allZero(page, inUse + (page - first) / systemPage)) {
+                alloc->dataPages[index] = 1;
+                changedFirst = min(changedFirst, index);
+                changedLast = index + 1;
+            }
+        }
+        free(inUse);
+
+        if (changedFirst < changedLast) {
+            pushToAll((uintptr_t)(alloc->dataPages + changedFirst),
+                    (uintptr_t)(alloc->dataPages + changedLast));
+        }
+    }
+}
+
+/* Records which parts of our pages in [start, end[ changed since we last
+ * published them, and keeps their new contents to compare with next time. A
+ * node that kept a copy of such a page then only gets the changed parts, see
+ * fetchDelta. */
+static void publishChanges(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    size_t segment = Shray_Pagesz / DELTA_SEGMENTS;
+    size_t blocks = numberOfBlocks(alloc);
+
+    for (size_t block = firstLocalBlock(alloc, start);
+            block < blocks && startWrite(alloc, block) < end;
+            block = nextLocalBlock(alloc, block)) {
+        uintptr_t first, last;
+        ownedPages(alloc, block, start, end, &first, &last);
+
+        for (uintptr_t page = first; page < last; page += Shray_Pagesz) {
+            size_t offset = page - alloc->location;
+            char *current = (char *)page;
+            char *copy = alloc->previous + offset;
+
+            uint64_t mask = 0;
+            for (size_t k = 0; k < DELTA_SEGMENTS; k++) {
+                if (memcmp(current + k * segment, copy + k * segment,
+                            segment) != 0) {
+                    memcpy(copy + k * segment, current + k * segment,
+                            segment);
+                    mask |= (uint64_t)1 << k;
+                }
+            }
+
+            if (mask != 0) {
+                PageDelta *delta = alloc->deltas + offset / Shray_Pagesz;
+                delta->previousChanged = delta->changed;
+                delta->changed = alloc->epoch + 1;
+                delta->mask = mask;
+            }
+        }
+    }
+}
+
+/* Makes our writes to [start, end[ available to the other nodes, and drops
+ * our cached copies of their writes. */
+static void publish(Allocation *alloc, uintptr_t start, uintptr_t end)
+{
+    if (alloc->replicated) {
+        /* One collective is cheapest for small arrays, for large arrays
+         * the padding and extra copies would cost more. */
+        if (alloc->size <= REPLICATED_PAGES * Shray_Pagesz) {
+            gatherReplicated(alloc);
+        } else {
+            ringAllgather(alloc, start, end);
+        }
+        alloc->epoch++;
+        return;
+    }
+
+    publishZeroPages(alloc, start, end);
+    if (alloc->deltas != NULL) {
+        publishChanges(alloc, start, end);
+    }
+
+    size_t blocks = numberOfBlocks(alloc);
+    for (size_t block = firstLocalBlock(alloc, start);
+            block < blocks && startWrite(alloc, block) < end;
+            block = nextLocalBlock(alloc, block)) {
+        UpdateLeftPage(alloc, block, start, end);
+        UpdateRightPage(alloc, block, start, end);
+    }
+
+    alloc->epoch++;
+    if (alloc->maxStaleness > 0) {
+        evictStalePages(alloc, (start - alloc->location) / Shray_Pagesz,
+                roundUp(end - alloc->location, Shray_Pagesz));
+    } else if (start == alloc->location &&
+            end == alloc->location + alloc->size) {
+        ShrayResetCache(alloc);
+    } else {
+        invalidateRange(alloc, start, end);
+    }
+}
+
+void ShraySync(void *unused, ...)
+{
+    lock();
+
+    void *array;
+    va_list ap;
+    bool merged = false;
+
+    /* Remote updates, and the writes to multi-writer arrays, are first
+     * merged into the owners, so the owners push up-to-date boundary pages
+     * below. */
+    va_start(ap, unused);
+    while ((array = va_arg(ap, void *)) != NULL) {
+        Allocation *alloc = findAlloc(array);
+        if (alloc->multiWriter) {
+            mergeTwins(alloc, alloc->location, alloc->location + alloc->size);
+        }
+        merged = merged || alloc->remoteUpdates;
+    }
+    va_end(ap);
+
+    if (merged) {
+        completeUpdates();
+        gasnet_wait_syncnbi_puts();
+        gasnetBarrier();
+    }
+
+    va_start(ap, unused);
+
+    /* Note that in shray2.h the ShraySync macro appends a NULL after the
+     * arguments, and a NULL before the arguments. */
+    while ((array = va_arg(ap, void *)) != NULL) {
+        Allocation *alloc = findAlloc(array);
+        publish(alloc, alloc->location, alloc->location + alloc->size);
+        DBUG_PRINT("We are updating pages for %p", array);
+    }
+
+    va_end(ap);
+
+    gasnet_wait_syncnbi_puts();
+
+    /* So no one reads from us before the communications are completed. */
+    gasnetBarrier();
+
+    /* Our boundary pages are up to date now. */
+    if (merged) {
+        va_start(ap, unused);
+        while ((array = va_arg(ap, void *)) != NULL) {
+            Allocation *alloc = findAlloc(array);
+            if (alloc->multiWriter) {
+                resetTwins(alloc, alloc->location,
+                        alloc->location + alloc->size);
+            }
+        }
+        va_end(ap);
+    }
+
+    unlock();
+}
+
+void ShraySyncRange(void *array, size_t firstIndexStart, size_t firstIndexEnd)
+{
+    lock();
+
+    Allocation *alloc = findAlloc(array);
+    size_t bytesPerRow = alloc->bytesPerRow;
+    uintptr_t start = alloc->location + firstIndexStart * bytesPerRow;
+    uintptr_t end = alloc->location + firstIndexEnd * bytesPerRow;
+
+    DBUG_PRINT("We are updating [%p, %p[", (void *)start, (void *)end);
+
+    if (alloc->remoteUpdates) {
+        if (alloc->multiWriter) {
+            mergeTwins(alloc, start, end);
+        }
+        completeUpdates();
+        gasnet_wait_syncnbi_puts();
+        gasnetBarrier();
+    }
+
+    publish(alloc, start, end);
+
+    gasnet_wait_syncnbi_puts();
+    gasnetBarrier();
+
+    if (alloc->multiWriter) {
+        resetTwins(alloc, start, end);
+    }
+
+    unlock();
+}
+
+void ShrayFetchAll(void *array)
+{
+    lock();
+
+    Allocation *alloc = findAlloc(array);
+
+    if (alloc->multiWriter) {
+        fprintf(stderr, "[node %d]: ShrayFetchAll does not support "
+                "multi-writer arrays.\n", Shray_rank);
+        gasnet_exit(1);
+    }
+
+    /* Replicated arrays are complete after every ShraySync. */
+    if (alloc->replicated) {
+        unlock();
+        return;
+    }
+
+    forRemotePages(alloc, alloc->location,
+            roundUpPage(alloc->location + alloc->size), addCacheEntry);
+
+    /* So no one puts into pages we have not mapped yet. */
+    gasnetBarrier();
+
+    ringAllgather(alloc, alloc->location, alloc->location + alloc->size);
+
+    unlock();
+}
+
+void ShrayRedistribute(void *destination, void *source)
+{
+    lock();
+
+    Allocation *to = findAlloc(destination);
+    Allocation *from = findAlloc(source);
+
+    if (to->size != from->size) {
+        fprintf(stderr, "[node %d]: ShrayRedistribute: arrays of %zu and %zu "
+                "bytes\n", Shray_rank, to->size, from->size);
+        gasnet_exit(1);
+    }
+
+    /* Get every part of our blocks of destination from the owner in
+     * source. */
+    size_t blocks = numberOfBlocks(to);
+    for (size_t block = firstLocalBlock(to, to->location); block < blocks;
+            block = nextLocalBlock(to, block)) {
+        size_t offset = startWrite(to, block) - to->location;
+        size_t end = endWrite(to, block) - to->location;
+
+        while (offset < end) {
+            size_t fromBlock = findBlock(from, from->location + offset);
+            unsigned int owner = blockOwner(from, fromBlock);
+            size_t stop = min(end, endWrite(from, fromBlock) - from->location);
+            void *target = (void *)(to->location + offset);
+            void *origin = (void *)(from->location + offset);
+
+            DBUG_PRINT("Redistribute: get [%p, %p[ from node %u", origin,
+                    (void *)(from->location + stop), owner);
+            if (owner == Shray_rank) {
+                memcpy(target, origin, stop - offset);
+            } else {
+                gasnet_get_nbi_bulk(target, owner, origin, stop - offset);
+            }
+
+            offset = stop;
+        }
+    }
+
+    gasnet_wait_syncnbi_gets();
+
+    /* Like ShraySync(destination). */
+    publish(to, to->location, to->location + to->size);
+    gasnet_wait_syncnbi_puts();
+    gasnetBarrier();
+
+    if (to->multiWriter) {
+        resetTwins(to, to->location, to->location + to->size);
+    }
+
+    unlock();
+}
+
+/* Writes bytes bytes from buffer to offset of file fd, which is called
+ * path. */
+static void writeFully(int fd, const void *buffer, size_t bytes, off_t offset,
+        const char *path)
+{
+    while (bytes > 0) {
+        ssize_t written = pwrite(fd, buffer, bytes, offset);
+        if (written <= 0) {
+            fprintf(stderr, "[node %d]: writing %s: ", Shray_rank, path);
+            perror("");
+            gasnet_exit(1);
+        }
+        buffer = (const char *)buffer + written;
+        bytes -= written;
+        offset += written;
+    }
+}
 
-    size_t cacheEntries = min(1, segmentLength / Shray_Pagesz *
-                                            Shray_CacheAllocFactor);
-    alloc->autoCaches = ringbuffer_alloc(cacheEntries);
-    if (!alloc->autoCaches) {
-        fprintf(stderr, "[node %d]: Could not allocate autocache", Shray_rank);
+/* Reads bytes bytes from offset of file fd, which is called path, into
+ * buffer. */
+static void readFully(int fd, void *buffer, size_t bytes, off_t offset,
+        const char *path)
+{
+    while (bytes > 0) {
+        ssize_t got = pread(fd, buffer, bytes, offset);
+        if (got <= 0) {
+            fprintf(stderr, "[node %d]: reading %s: %s\n", Shray_rank, path,
+                    (got == 0) ? "file is too short" : strerror(errno));
+            gasnet_exit(1);
+        }
+        buffer = (char *)buffer + got;
+        bytes -= got;
+        offset += got;
+    }
+}
+
+/* Opens path with flags, and with O_DIRECT as well into *directFd, which is
+ * -1 if the file system does not support it. */
+static int openFile(const char *path, int flags, int *directFd)
+{
+    int fd = open(path, flags | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "[node %d]: opening %s: ", Shray_rank, path);
+        perror("");
         gasnet_exit(1);
     }
-    DBUG_PRINT("Allocated %zu automatic cache entries (%zu)", cacheEntries,
-            totalSize / Shray_Pagesz);
 
+#ifdef O_DIRECT
+    *directFd = open(path, (flags & ~(O_CREAT | O_TRUNC)) | O_DIRECT |
+            O_CLOEXEC);
+#else
+    *directFd = -1;
+#endif
+
+    return fd;
+}
+
+static void closeFile(int fd, int directFd)
+{
+    close(fd);
+    if (directFd != -1) {
+        close(directFd);
+    }
+}
+
+/* Transfers bytes bytes between memory and offset of directFd, returns how
+ * many, which is less if the file system refuses the alignment or the file
+ * ends. */
+static size_t transferDirect(bool write, int directFd, char *memory,
+        size_t bytes, off_t offset, const char *path)
+{
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t moved = write ?
+            pwrite(directFd, memory + done, bytes - done, offset + done) :
+            pread(directFd, memory + done, bytes - done, offset + done);
+        if (moved == 0 || (moved == -1 && errno == EINVAL)) break;
+        if (moved == -1) {
+            fprintf(stderr, "[node %d]: %s %s: ", Shray_rank,
+                    write ? "writing" : "reading", path);
+            perror("");
+            gasnet_exit(1);
+        }
+        done += moved;
+    }
+
+    return done;
+}
+
+/* Transfers segment, with O_DIRECT for its aligned middle if we can. */
+static void transferSegment(bool write, int fd, int directFd,
+        const FileSegment *segment, const char *path)
+{
+    char *memory = segment->memory;
+    size_t length = segment->length;
+    off_t offset = segment->offset;
+
+    /* The start and end up to the alignment go through the page cache. */
+    size_t head = 0;
+    size_t middle = 0;
+    if (directFd != -1 &&
+            ((uintptr_t)memory - (uint64_t)offset) % IO_ALIGN == 0) {
+        head = min(length, (IO_ALIGN - (uintptr_t)memory % IO_ALIGN) %
+                IO_ALIGN);
+        middle = (length - head) / IO_ALIGN * IO_ALIGN;
+    }
+    if (middle > 0) {
+        middle = transferDirect(write, directFd, memory + head, middle,
+                offset + head, path);
+    }
+
+    size_t rest = length - head - middle;
+    if (write) {
+        writeFully(fd, memory, head, offset, path);
+        writeFully(fd, memory + head + middle, rest, offset + head + middle,
+                path);
+    } else {
+        readFully(fd, memory, head, offset, path);
+        readFully(fd, memory + head + middle, rest, offset + head + middle,
+                path);
+    }
+}
+
+/* Splits segments at multiples of IO_CHUNK in the file into chunks, if not
+ * NULL, and returns how many there are. */
+static size_t splitChunks(const FileSegment *segments, size_t numberOfSegments,
+        FileSegment *chunks)
+{
+    size_t numberOfChunks = 0;
+
+    for (size_t k = 0; k < numberOfSegments; k++) {
+        const FileSegment *segment = segments + k;
+        uint64_t end = segment->offset + segment->length;
+        for (uint64_t offset = segment->offset; offset < end;) {
+            uint64_t stop = min(end, (offset / IO_CHUNK + 1) * IO_CHUNK);
+            if (chunks != NULL) {
+                chunks[numberOfChunks] = (FileSegment){
+                    .memory = segment->memory + (offset - segment->offset),
+                    .length = stop - offset,
+                    .offset = offset,
+                };
+            }
+            numberOfChunks++;
+            offset = stop;
+        }
+    }
+
+    return numberOfChunks;
+}
+
+/* Transfers segments between memory and the file fd, in chunks that our
+ * threads do in parallel if parallel. */
+static void transferSegments(bool write, int fd, int directFd,
+        const FileSegment *segments, size_t numberOfSegments,
+        const char *path, bool parallel)
+{
+    size_t numberOfChunks = splitChunks(segments, numberOfSegments, NULL);
+    FileSegment *chunks;
+    MALLOC_SAFE(chunks, max(numberOfChunks, 1) * sizeof(FileSegment));
+    splitChunks(segments, numberOfSegments, chunks);
+
+    #pragma omp parallel for schedule(dynamic) if (parallel)
+    for (size_t k = 0; k < numberOfChunks; k++) {
+        transferSegment(write, fd, directFd, chunks + k, path);
+    }
+
+    free(chunks);
+}
+
+/* Our part of alloc, as segments of a file that stores it in order from
+ * fileOffset on. To read we take our Ar_b, so we need not exchange boundary
+ * pages and halos, to write our Aw_b. Returns the number of segments, and
+ * allocates *segments. */
+static size_t fileSegments(Allocation *alloc, bool read, uint64_t fileOffset,
+        FileSegment **segments)
+{
+    size_t blocks = numberOfBlocks(alloc);
+    size_t ourBlocks = 0;
+    for (size_t block = firstLocalBlock(alloc, alloc->location);
+            block < blocks; block = nextLocalBlock(alloc, block)) {
+        ourBlocks++;
+    }
+    MALLOC_SAFE(*segments, max(ourBlocks, 1) * sizeof(FileSegment));
+
+    size_t numberOfSegments = 0;
+    uintptr_t end = alloc->location + alloc->size;
+    uintptr_t done = alloc->location;
+    for (size_t block = firstLocalBlock(alloc, alloc->location);
+            block < blocks; block = nextLocalBlock(alloc, block)) {
+        uintptr_t first = read ? max(startRead(alloc, block), done) :
+            startWrite(alloc, block);
+        uintptr_t last = read ? min(endRead(alloc, block), end) :
+            endWrite(alloc, block);
+        if (first >= last) continue;
+        done = last;
+
+        uint64_t offset = fileOffset + (first - alloc->location);
+        FileSegment *tail = *segments + numberOfSegments - 1;
+        if (numberOfSegments > 0 &&
+                (uint64_t)tail->offset + tail->length == offset) {
+            tail->length += last - first;
+        } else {
+            (*segments)[numberOfSegments++] = (FileSegment){
+                .memory = (char *)first,
+                .length = last - first,
+                .offset = offset,
+            };
+        }
+    }
+
+    return numberOfSegments;
+}
+
+void ShrayReadFile(void *array, const char *path, size_t offset)
+{
+    lock();
+
+    Allocation *alloc = findAlloc(array);
+
+    int directFd;
+    int fd = openFile(path, O_RDONLY, &directFd);
+    FileSegment *segments;
+    size_t numberOfSegments = fileSegments(alloc, true, offset, &segments);
+    transferSegments(false, fd, directFd, segments, numberOfSegments, path,
+            true);
+    free(segments);
+    closeFile(fd, directFd);
+
+    /* So no node uses the old contents anymore when we push into it. */
+    gasnetBarrier();
+
+    /* Like ShraySync(array). */
+    publish(alloc, alloc->location, alloc->location + alloc->size);
+    gasnet_wait_syncnbi_puts();
     gasnetBarrier();
 
+    if (alloc->multiWriter) {
+        resetTwins(alloc, alloc->location, alloc->location + alloc->size);
+    }
+
     unlock();
-    return location;
 }
 
-size_t ShrayStart(void *array)
+void ShrayWriteFile(void *array, const char *path, size_t offset)
 {
+    lock();
+
     Allocation *alloc = findAlloc(array);
-    size_t result = Shray_rank * roundUp(alloc->firstDimension, Shray_size);
-    return result;
+
+    int directFd;
+    int fd = openFile(path, O_WRONLY | O_CREAT, &directFd);
+    FileSegment *segments;
+    size_t numberOfSegments = fileSegments(alloc, false, offset, &segments);
+    transferSegments(true, fd, directFd, segments, numberOfSegments, path,
+            true);
+    free(segments);
+    closeFile(fd, directFd);
+
+    /* So the file is complete when we return. */
+    gasnetBarrier();
+
+    unlock();
 }
 
-size_t ShrayEnd(void *array)
+/* Writes the segments of the pending checkpoint, in the background if it has
+ * a snapshot. The background writer leaves our threads to the program. */
+static void *writeCheckpoint(void *unused)
+{
+    (void)unused;
+
+    transferSegments(true, checkpoint.fd, checkpoint.directFd,
+            checkpoint.segments, checkpoint.numberOfSegments,
+            checkpoint.partial, checkpoint.snapshot == NULL);
+
+    if (fsync(checkpoint.fd) != 0) {
+        fprintf(stderr, "[node %d]: writing %s: ", Shray_rank,
+                checkpoint.partial);
+        perror("");
+        gasnet_exit(1);
+    }
+
+    return NULL;
+}
+
+/* Waits until our part of the pending checkpoint is written, and moves the
+ * file to its path once all nodes are done, so a checkpoint at path is
+ * always complete. Collective. */
+static void finishCheckpoint(void)
+{
+    if (checkpoint.path == NULL) return;
+
+    if (checkpoint.snapshot != NULL) {
+        pthread_join(checkpoint.writer, NULL);
+        free(checkpoint.snapshot);
+    }
+    closeFile(checkpoint.fd, checkpoint.directFd);
+    free(checkpoint.segments);
+
+    gasnetBarrier();
+
+    if (Shray_rank == 0 && rename(checkpoint.partial, checkpoint.path) != 0) {
+        fprintf(stderr, "[node %d]: moving %s to %s: ", Shray_rank,
+                checkpoint.partial, checkpoint.path);
+        perror("");
+        gasnet_exit(1);
+    }
+
+    DBUG_PRINT("Checkpoint %s is complete", checkpoint.path);
+
+    free(checkpoint.path);
+    free(checkpoint.partial);
+    checkpoint.path = NULL;
+}
+
+/* Writes the header that describes alloc, stored from dataOffset on, to
+ * offset of file fd, which is called path. */
+static void writeHeader(int fd, Allocation *alloc, uint64_t dataOffset,
+        off_t offset, const char *path)
+{
+    CheckpointHeader header = {
+        .version = CHECKPOINT_VERSION,
+        .dataOffset = dataOffset,
+        .firstDimension = alloc->firstDimension,
+        .size = alloc->size,
+        .ranks = Shray_size,
+        .hasSplitPoints = (alloc->splitPoints != NULL),
+        .blockRows = alloc->blockRows,
+        .columns = alloc->columns,
+        .gridRows = alloc->gridRows,
+        .gridCols = alloc->gridCols,
+        .haloRows = alloc->haloRows,
+        .replicated = alloc->replicated,
+        .maxStaleness = alloc->maxStaleness,
+        .multiWriter = alloc->multiWriter,
+        .remoteUpdates = alloc->remoteUpdates,
+    };
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    writeFully(fd, &header, sizeof(CheckpointHeader), offset, path);
+
+    if (alloc->splitPoints != NULL) {
+        uint64_t *splitPoints;
+        MALLOC_SAFE(splitPoints, (Shray_size + 1) * sizeof(uint64_t));
+        for (unsigned int rank = 0; rank <= Shray_size; rank++) {
+            splitPoints[rank] = alloc->splitPoints[rank];
+        }
+        writeFully(fd, splitPoints, (Shray_size + 1) * sizeof(uint64_t),
+                offset + sizeof(CheckpointHeader), path);
+        free(splitPoints);
+    }
+}
+
+/* Reads the header at offset of file fd, which is called path, and the split
+ * points into *splitPoints if they are for this number of nodes, NULL
+ * otherwise. */
+static void readHeader(int fd, off_t offset, const char *path,
+        CheckpointHeader *header, size_t **splitPoints)
+{
+    readFully(fd, header, sizeof(CheckpointHeader), offset, path);
+    if (memcmp(header->magic, CHECKPOINT_MAGIC, sizeof(header->magic)) != 0 ||
+            header->version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "[node %d]: %s was not saved by this version of "
+                "Shray\n", Shray_rank, path);
+        gasnet_exit(1);
+    }
+
+    *splitPoints = NULL;
+    if (header->hasSplitPoints && header->ranks == Shray_size) {
+        uint64_t *stored;
+        MALLOC_SAFE(stored, (Shray_size + 1) * sizeof(uint64_t));
+        MALLOC_SAFE(*splitPoints, (Shray_size + 1) * sizeof(size_t));
+        readFully(fd, stored, (Shray_size + 1) * sizeof(uint64_t),
+                offset + sizeof(CheckpointHeader), path);
+        for (unsigned int rank = 0; rank <= Shray_size; rank++) {
+            (*splitPoints)[rank] = stored[rank];
+        }
+        free(stored);
+    }
+}
+
+/* Allocates the array described by header with the same distribution, from
+ * the file stored in the store if it is not NULL. Frees splitPoints. */
+static Allocation *allocateSaved(const CheckpointHeader *header,
+        size_t *splitPoints, const char *stored)
+{
+    /* On a different number of nodes, we keep what of the distribution
+     * does not depend on it. */
+    Distribution distribution = {
+        .splitPoints = splitPoints,
+        .blockRows = header->blockRows,
+        .haloRows = header->haloRows,
+        .replicated = header->replicated,
+        .stored = stored,
+    };
+    if (header->gridCols != 0) {
+        distribution.columns = header->columns;
+        distribution.gridRows = header->gridRows;
+        distribution.gridCols = header->gridCols;
+        if (header->ranks != Shray_size) {
+            squareGrid(&distribution.gridRows, &distribution.gridCols);
+        }
+    }
+
+    Allocation *alloc = allocate(header->firstDimension, header->size,
+            &distribution);
+    free(splitPoints);
+
+    return alloc;
+}
+
+/* Finishes an allocation by allocateSaved once our Ar_b holds the array. */
+static void publishSaved(Allocation *alloc, const CheckpointHeader *header)
+{
+    /* So every node has allocated before we put into it. */
+    gasnetBarrier();
+
+    /* Like ShraySync(location), so the other nodes know which of our pages
+     * hold data. */
+    publish(alloc, alloc->location, alloc->location + alloc->size);
+    gasnet_wait_syncnbi_puts();
+    gasnetBarrier();
+
+    if (header->maxStaleness > 0) {
+        makeStale(alloc, header->maxStaleness);
+    }
+    if (header->multiWriter) {
+        makeMultiWriter(alloc);
+    }
+    alloc->remoteUpdates = header->remoteUpdates;
+}
+
+/* Creates the checkpoint file of alloc and writes its header. */
+static void createCheckpoint(Allocation *alloc, uint64_t dataOffset)
+{
+    int fd = open(checkpoint.partial, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            0644);
+    if (fd == -1 || ftruncate(fd, dataOffset + alloc->size) != 0) {
+        fprintf(stderr, "[node %d]: creating %s: ", Shray_rank,
+                checkpoint.partial);
+        perror("");
+        gasnet_exit(1);
+    }
+
+    writeHeader(fd, alloc, dataOffset, 0, checkpoint.partial);
+
+    close(fd);
+}
+
+void ShrayCheckpoint(void *array, const char *path)
 {
+    lock();
+
     Allocation *alloc = findAlloc(array);
-    size_t firstDimension = alloc->firstDimension;
-    size_t result = (Shray_rank == Shray_size - 1) ? firstDimension :
-        (Shray_rank + 1) * roundUp(firstDimension, Shray_size);
-    return result;
+
+    /* At most one checkpoint is pending. */
+    finishCheckpoint();
+
+    size_t pathLength = strlen(path) + 1;
+    MALLOC_SAFE(checkpoint.path, pathLength);
+    memcpy(checkpoint.path, path, pathLength);
+    MALLOC_SAFE(checkpoint.partial, pathLength + strlen(".partial"));
+    snprintf(checkpoint.partial, pathLength + strlen(".partial"),
+            "%s.partial", path);
+
+    size_t headerBytes = sizeof(CheckpointHeader) +
+        (Shray_size + 1) * sizeof(uint64_t);
+    uint64_t dataOffset = roundUp(headerBytes, CHECKPOINT_ALIGN) *
+        CHECKPOINT_ALIGN;
+    if (Shray_rank == 0) {
+        createCheckpoint(alloc, dataOffset);
+    }
+
+    /* So the file exists before we open it. */
+    gasnetBarrier();
+
+    checkpoint.fd = openFile(checkpoint.partial, O_WRONLY,
+            &checkpoint.directFd);
+
+    /* The array is stored in order, our blocks go to their offset. */
+    checkpoint.numberOfSegments = fileSegments(alloc, false, dataOffset,
+            &checkpoint.segments);
+    size_t bytes = 0;
+    for (size_t k = 0; k < checkpoint.numberOfSegments; k++) {
+        bytes += checkpoint.segments[k].length;
+    }
+
+    checkpoint.snapshot = NULL;
+    if (asyncCheckpoints) {
+        /* We may write to the array as soon as we return. */
+        MALLOC_SAFE(checkpoint.snapshot, max(bytes, 1));
+        char *copy = checkpoint.snapshot;
+        for (size_t k = 0; k < checkpoint.numberOfSegments; k++) {
+            FileSegment *segment = checkpoint.segments + k;
+            memcpy(copy, segment->memory, segment->length);
+            segment->memory = copy;
+            copy += segment->length;
+        }
+
+        if (pthread_create(&checkpoint.writer, NULL, writeCheckpoint,
+                    NULL) != 0) {
+            fprintf(stderr, "[node %d]: could not start writing %s\n",
+                    Shray_rank, checkpoint.partial);
+            gasnet_exit(1);
+        }
+    } else {
+        writeCheckpoint(NULL);
+        finishCheckpoint();
+    }
+
+    unlock();
 }
 
-static void UpdateLeftPage(Allocation *alloc)
+void *ShrayRestore(const char *path)
 {
-    uintptr_t firstPage = startRead(alloc, Shray_rank);
-    /* Rank s has to send
-     * [start, end[ := Aw_s \cap [firstPage, firstPage + Shray_Pagesz[ to
-     * rank t whenever [start, end[ \cap Ar_t is non-empty. */
-    uintptr_t start = max(startWrite(alloc, Shray_rank), firstPage);
-    uintptr_t end = min(endWrite(alloc, Shray_rank), firstPage + Shray_Pagesz);
+    lock();
+
+    /* The file may be the checkpoint we are still writing. */
+    finishCheckpoint();
+
+    int directFd;
+    int fd = openFile(path, O_RDONLY, &directFd);
+
+    CheckpointHeader header;
+    size_t *splitPoints;
+    readHeader(fd, 0, path, &header, &splitPoints);
+
+    Allocation *alloc = allocateSaved(&header, splitPoints, NULL);
+    void *location = (void *)alloc->location;
+
+    FileSegment *segments;
+    size_t numberOfSegments = fileSegments(alloc, true, header.dataOffset,
+            &segments);
+    transferSegments(false, fd, directFd, segments, numberOfSegments, path,
+            true);
+    free(segments);
+    closeFile(fd, directFd);
+
+    publishSaved(alloc, &header);
+
+    unlock();
+    return location;
+}
 
-    int rank = Shray_rank - 1;
-    for (; rank >= 0 && endRead(alloc, rank) - 1 >= start; rank--) {
-        DBUG_PRINT("Put [%p, %p[ into node %u",
-                (void *)start, (void *)end, rank);
-        gasnet_put_bulk(rank, (void *)start, (void *)start, end - start);
+/* Path of our file of the array name in the store, followed by suffix. */
+static char *storePath(const char *name, const char *suffix)
+{
+    if (name[0] == '\0' || strchr(name, '/') != NULL) {
+        fprintf(stderr, "[node %d]: '%s' is not a valid name in the store\n",
+                Shray_rank, name);
+        gasnet_exit(1);
     }
+
+    size_t length = snprintf(NULL, 0, "%s/shray.%s.%u%s", storeDirectory,
+            name, Shray_rank, suffix) + 1;
+    char *path;
+    MALLOC_SAFE(path, length);
+    snprintf(path, length, "%s/shray.%s.%u%s", storeDirectory, name,
+            Shray_rank, suffix);
+
+    return path;
+}
+
+/* Bytes after the array in a file of the store. */
+static size_t storeTrailerBytes(void)
+{
+    return sizeof(CheckpointHeader) + (Shray_size + 1) * sizeof(uint64_t);
 }
 
-static void UpdateRightPage(Allocation *alloc)
+void ShrayStore(void *array, const char *name)
 {
-    uintptr_t lastPage = endRead(alloc, Shray_rank) - Shray_Pagesz;
-    /* Rank s has to send
-     * [start, end[ := Aw_s \cap [lastPage, lastPage + Shray_Pagesz[ to
-     * rank t whenever [start, end[ \cap Ar_t is non-empty. */
-    uintptr_t start = max(startWrite(alloc, Shray_rank), lastPage);
-    uintptr_t end = min(endWrite(alloc, Shray_rank), lastPage + Shray_Pagesz);
+    lock();
+
+    Allocation *alloc = findAlloc(array);
+    char *path = storePath(name, "");
+    char *partial = storePath(name, ".partial");
+
+    /* Our Ar_b at its place in the array, so ShrayAttach can map the file
+     * like a partition, the rest is a hole. The header comes after it. */
+    int directFd;
+    int fd = openFile(partial, O_WRONLY | O_CREAT | O_TRUNC, &directFd);
+    if (ftruncate(fd, roundUpPage(alloc->size) + storeTrailerBytes()) != 0) {
+        fprintf(stderr, "[node %d]: creating %s: ", Shray_rank, partial);
+        perror("");
+        gasnet_exit(1);
+    }
 
-    unsigned int rank = Shray_rank + 1;
-    for (; rank < Shray_size && startRead(alloc, rank) < end; rank++) {
-        DBUG_PRINT("Put [%p, %p[ into node %u",
-                (void *)start, (void *)end, rank);
-        gasnet_put_bulk(rank, (void *)start, (void *)start, end - start);
+    FileSegment *segments;
+    size_t numberOfSegments = fileSegments(alloc, true, 0, &segments);
+    transferSegments(true, fd, directFd, segments, numberOfSegments, partial,
+            true);
+    free(segments);
+    writeHeader(fd, alloc, 0, roundUpPage(alloc->size), partial);
+    closeFile(fd, directFd);
+
+    /* A job that attaches meanwhile sees the old array or the new one. */
+    if (rename(partial, path) != 0) {
+        fprintf(stderr, "[node %d]: moving %s to %s: ", Shray_rank, partial,
+                path);
+        perror("");
+        gasnet_exit(1);
     }
+
+    DBUG_PRINT("Stored %p as %s", array, path);
+
+    free(path);
+    free(partial);
+
+    /* So the whole array is in the store when we return. */
+    gasnetBarrier();
+
+    unlock();
 }
 
-void ShraySync(void *unused, ...)
+void *ShrayAttach(const char *name)
 {
     lock();
 
-    void *array;
-    va_list ap;
-    va_start(ap, unused);
+    char *path = storePath(name, "");
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) != 0) {
+        fprintf(stderr, "[node %d]: opening %s: ", Shray_rank, path);
+        perror("");
+        gasnet_exit(1);
+    }
 
-    /* Note that in shray2.h the ShraySync macro appends a NULL after the
-     * arguments, and a NULL before the arguments. */
-    while ((array = va_arg(ap, void *)) != NULL) {
-        Allocation *alloc = findAlloc(array);
-        UpdateLeftPage(alloc);
-        UpdateRightPage(alloc);
-        ShrayResetCache(alloc);
-        DBUG_PRINT("We are updating pages for %p", array);
+    if ((size_t)status.st_size < storeTrailerBytes()) {
+        fprintf(stderr, "[node %d]: %s is not in the store\n", Shray_rank,
+                path);
+        gasnet_exit(1);
     }
 
-    va_end(ap);
+    CheckpointHeader header;
+    size_t *splitPoints;
+    off_t headerOffset = status.st_size - storeTrailerBytes();
+    readHeader(fd, headerOffset, path, &header, &splitPoints);
+    close(fd);
+
+    /* Our file only holds our Ar_b. */
+    if (header.ranks != Shray_size ||
+            (uint64_t)headerOffset != roundUpPage(header.size)) {
+        fprintf(stderr, "[node %d]: %s was stored by %zu nodes, we are %u\n",
+                Shray_rank, path, (size_t)header.ranks, Shray_size);
+        gasnet_exit(1);
+    }
 
-    gasnet_wait_syncnbi_puts();
+    Allocation *alloc = allocateSaved(&header, splitPoints, path);
+    void *location = (void *)alloc->location;
+    free(path);
+
+    publishSaved(alloc, &header);
+
+    unlock();
+    return location;
+}
+
+void ShrayUnstore(const char *name)
+{
+    lock();
+
+    char *path = storePath(name, "");
+    if (unlink(path) != 0 && errno != ENOENT) {
+        fprintf(stderr, "[node %d]: removing %s: ", Shray_rank, path);
+        perror("");
+        gasnet_exit(1);
+    }
+    free(path);
 
-    /* So no one reads from us before the communications are completed. */
     gasnetBarrier();
+
+    unlock();
+}
+
+void ShrayAcceptUpdates(void *array)
+{
+    lock();
+
+    findAlloc(array)->remoteUpdates = true;
+
+    unlock();
+}
+
+void ShrayAccumulate(void *array, size_t index, const void *values, size_t n,
+        ShrayType type, ShrayOp op)
+{
+    lock();
+    Allocation *alloc = findAlloc(array);
+    unlock();
+
+    size_t elementSize = typeSize(type);
+    uintptr_t start = (uintptr_t)array + index * elementSize;
+    uintptr_t end = start + n * elementSize;
+    const char *source = values;
+
+    if (end > alloc->location + alloc->size) {
+        fprintf(stderr, "[node %d]: ShrayAccumulate: [%p, %p[ is not in an "
+                "allocation\n", Shray_rank, (void *)start, (void *)end);
+        gasnet_exit(1);
+    }
+
+    /* values may lie on a remote page we do not have, so we copy it before
+     * taking a lock, leaving the fault handler free to fetch the page. */
+    int64_t staged[UPDATE_STAGE / sizeof(int64_t)];
+    size_t stageSize = UPDATE_STAGE / elementSize * elementSize;
+
+    while (start < end) {
+        uintptr_t stageEnd = min(end, start + stageSize);
+        const char *value = (const char *)staged;
+        memcpy(staged, source, stageEnd - start);
+        source += stageEnd - start;
+
+        while (start < stageEnd) {
+            size_t block = findBlock(alloc, start);
+            unsigned int owner = blockOwner(alloc, block);
+            uintptr_t stop = min(stageEnd, endWrite(alloc, block));
+            size_t count = (stop - start) / elementSize;
+
+            if (owner == Shray_rank) {
+                applyAccumulate((void *)start, value, count, type, op);
+            } else if (alloc->remoteUpdates) {
+                while (atomic_test_set(&buffer_lock));
+                bufferAccumulate(owner, start, value, count, type, op);
+                atomic_clear(&buffer_lock);
+            } else {
+                fprintf(stderr, "[node %d]: ShrayAccumulate: %p is owned by "
+                        "node %u, but the array does not accept remote "
+                        "updates, see ShrayAcceptUpdates\n", Shray_rank,
+                        (void *)start, owner);
+                gasnet_exit(1);
+            }
+
+            value += count * elementSize;
+            start = stop;
+        }
+    }
+}
+
+void ShrayPut(void *array, size_t offset, const void *source, size_t size)
+{
+    lock();
+    Allocation *alloc = findAlloc(array);
     unlock();
+
+    uintptr_t start = (uintptr_t)array + offset;
+    uintptr_t end = start + size;
+    const char *from = source;
+
+    if (end > alloc->location + alloc->size) {
+        fprintf(stderr, "[node %d]: ShrayPut: [%p, %p[ is not in an "
+                "allocation\n", Shray_rank, (void *)start, (void *)end);
+        gasnet_exit(1);
+    }
+
+    /* As in ShrayAccumulate, source may lie on a remote page. */
+    char staged[UPDATE_STAGE];
+
+    while (start < end) {
+        uintptr_t stageEnd = min(end, start + UPDATE_STAGE);
+        const char *value = staged;
+        memcpy(staged, from, stageEnd - start);
+        from += stageEnd - start;
+
+        while (start < stageEnd) {
+            size_t block = findBlock(alloc, start);
+            unsigned int owner = blockOwner(alloc, block);
+            uintptr_t stop = min(stageEnd, endWrite(alloc, block));
+
+            if (owner == Shray_rank) {
+                applyPut((void *)start, value, stop - start);
+            } else if (alloc->remoteUpdates) {
+                while (atomic_test_set(&buffer_lock));
+                bufferPut(owner, start, value, stop - start);
+                atomic_clear(&buffer_lock);
+            } else {
+                fprintf(stderr, "[node %d]: ShrayPut: %p is owned by node "
+                        "%u, but the array does not accept remote updates, "
+                        "see ShrayAcceptUpdates\n", Shray_rank, (void *)start,
+                        owner);
+                gasnet_exit(1);
+            }
+
+            value += stop - start;
+            start = stop;
+        }
+    }
 }
 
 void ShrayFree(void *address)
@@ -505,10 +3900,24 @@ void ShrayFree(void *address)
     int index = findAllocIndex(address);
     Allocation *alloc = heap.allocs + index;
     ringbuffer_reset(alloc->autoCaches);
-    /* We leave potentially two pages mapped due to the alignment in
-     * ShrayMalloc, but who cares. */
-    MUNMAP_SAFE((void *)alloc->location, alloc->size);
+    /* Partition and host cache pages map files. */
+    returnChunk(alloc->location, alloc->size, alloc->memfd == -1);
+    returnChunk((uintptr_t)alloc->dataPages, alloc->local->size, true);
+    if (alloc->deltas != NULL) {
+        freeDeltas(alloc);
+    }
+    closeHostFiles(alloc);
+    if (alloc->fetchEpochs != NULL) {
+        MUNMAP_SAFE((void *)alloc->fetchEpochs,
+                alloc->local->size * sizeof(size_t));
+    }
+    if (alloc->multiWriter) {
+        freeTwins(alloc);
+        free(alloc->twins);
+        BitmapFree(alloc->twinned);
+    }
     BitmapFree(alloc->local);
+    free(alloc->splitPoints);
     heap.numberOfAllocs--;
     while ((unsigned)index < heap.numberOfAllocs) {
         heap.allocs[index] = heap.allocs[index + 1];
@@ -523,7 +3932,7 @@ void ShrayReport(void)
     fprintf(stderr, "Shray report P(%d) on %s: %zu segfaults, %zu barriers, "
             "%zu bytes communicated.\n", Shray_rank, ShrayHost,
             Shray_SegfaultCounter, Shray_BarrierCounter,
-            Shray_SegfaultCounter * Shray_Pagesz);
+            Shray_FetchedBytes - Shray_DeltaSavedBytes);
     unlock();
 }
 
@@ -541,6 +3950,7 @@ void ShrayFinalize(int exit_code)
 {
     DBUG_PRINT("Terminating with code %d", exit_code);
     if (exit_code == 0) {
+        finishCheckpoint();
         gasnetBarrier();
     }
     gasnet_exit(exit_code);
@@ -11,6 +11,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include <gasnet.h>
 #include <gasnet_coll.h>
 #include <sys/mman.h>
@@ -22,18 +23,196 @@
  * Data structures
  **************************************************/
 
+/* Copy of a page from before we first wrote to it in this epoch, see
+ * ShrayMallocMultiWriter. */
+typedef struct Twin {
+    uintptr_t page;
+    void *copy;
+} Twin;
+
+/* How an allocation is split over the nodes, see allocate in shray.c. */
+typedef struct Distribution {
+    /* Shray_size + 1 first rows per rank, NULL for blocks of
+     * roundUp(firstDimension, Shray_size) rows. */
+    const size_t *splitPoints;
+    /* Rows per block for a block-cyclic distribution, 0 otherwise. */
+    size_t blockRows;
+    /* For a tiled distribution over a gridRows x gridCols process grid, the
+     * second dimension, 0 otherwise. */
+    size_t columns;
+    unsigned int gridRows;
+    unsigned int gridCols;
+    /* Rows beyond each end of a block that its owner also stores. */
+    size_t haloRows;
+    /* Every node stores the complete allocation. */
+    bool replicated;
+    /* If not NULL, our partitions are mapped from a file in this directory
+     * instead of memory. */
+    const char *directory;
+    /* If not NULL, our partitions are mapped from this file in the store,
+     * which holds them already, see ShrayAttach. */
+    const char *stored;
+} Distribution;
+
+/* Start of the cache of remote pages that the ranks on a host share, in a
+ * file its leader creates. The header is followed by per page the slot + 1
+ * that holds its newest copy or 0, the slots, and the pages of the slots, see
+ * fetchHostCached. */
+typedef struct HostCacheHeader {
+    /* Protects the page directory and the assignment of slots. */
+    pthread_mutex_t lock;
+    /* Next slot to consider for reuse. */
+    size_t hand;
+} HostCacheHeader;
+
+/* A page of the host cache. users counts the ranks that map it, it is only
+ * reused once that is 0, as a private mapping still shows later writes to its
+ * file. */
+typedef struct HostSlot {
+    size_t page;
+    size_t epoch;
+    uint64_t users;
+    /* Nonzero once page has been fetched into the slot. */
+    uint64_t ready;
+} HostSlot;
+
+/* Which parts of a page its owner changed at the last ShraySync that changed
+ * it, see publishChanges. */
+typedef struct PageDelta {
+    /* The epochs this ShraySync and the one that changed the page before it
+     * started, 0 if there was none. */
+    size_t changed;
+    size_t previousChanged;
+    /* Bit k is set if the k-th of DELTA_SEGMENTS parts of the page changed. */
+    uint64_t mask;
+} PageDelta;
+
 /* A single allocation in the heap. */
 typedef struct Allocation {
     uintptr_t location;
     size_t size;
     size_t firstDimension;
-    /* The number of bytes owned by each node except the last one. */
-    size_t bytesPerBlock;
+    size_t bytesPerRow;
+    /* Number of rows per block for a block-cyclic allocation, 0 otherwise. */
+    size_t blockRows;
+    /* If not block-cyclic or tiled, rank r owns rows [splitPoints[r],
+     * splitPoints[r + 1][ of the first dimension, Shray_size + 1 entries. */
+    size_t *splitPoints;
+    /* For a tiled allocation the second dimension and the process grid,
+     * gridCols is 0 otherwise. */
+    size_t columns;
+    unsigned int gridRows;
+    unsigned int gridCols;
+    /* Rows beyond each end of a block that are pushed to its owner at every
+     * ShraySync, see ShrayMallocHalo. */
+    size_t haloRows;
+    /* Every node stores the complete allocation, ShraySync sends each block
+     * to all nodes. */
+    bool replicated;
+    /* File backing our Ar_b, so nodes on our host can map our pages, -1 if
+     * there are none. */
+    int memfd;
+    /* memfd is a file on disk or in the store, whose contents we keep, see
+     * ShrayMallocFile and ShrayAttach. */
+    bool onDisk;
+    /* Per rank the file backing its Ar_b if it runs on our host, -1
+     * otherwise, NULL if no two ranks share a host. */
+    int *hostFds;
+    /* Cache of remote pages shared by the ranks on our host, mapped from
+     * hostCacheFd, see HostCacheHeader. NULL if no other rank runs on our
+     * host. */
+    int hostCacheFd;
+    HostCacheHeader *hostCache;
+    size_t *hostNewest;
+    HostSlot *hostSlots;
+    char *hostSlotPages;
+    size_t numberOfHostSlots;
+    /* Per page the slot + 1 of the host cache we map it from, or 0. */
+    size_t *hostMapped;
+    /* Per page 0 if its owner found it all zero at its last ShraySync, so we
+     * map it locally instead of fetching it, see publishZeroPages. */
+    uint8_t *dataPages;
+    /* With SHRAY_DELTA, per page the last change by its owner, and the
+     * contents of our pages at our last ShraySync and of the remote pages we
+     * cached before it, so a refetch only gets what changed, see fetchDelta.
+     * deltas is NULL otherwise. */
+    PageDelta *deltas;
+    char *previous;
+    /* Remote pages with a copy in previous, and the epoch we fetched it in. */
+    Bitmap *retained;
+    size_t *retainedEpochs;
     Bitmap *local;
     /* Cache for segfaults. */
     ringbuffer_t *autoCaches;
+    /* Number of ShraySyncs a cached remote page may survive, 0 for
+     * exact consistency. */
+    unsigned int maxStaleness;
+    /* Number of ShraySyncs on this allocation so far. */
+    size_t epoch;
+    /* For maxStaleness > 0, the epoch in which each cached page was
+     * fetched. */
+    size_t *fetchEpochs;
+    /* True if we may write to elements we do not own, see
+     * ShrayMallocMultiWriter. */
+    bool multiWriter;
+    /* True if nodes may ShrayAccumulate and ShrayPut into elements they do
+     * not own, ShraySync then first waits until the owners applied them, see
+     * ShrayAcceptUpdates. Multi-writer allocations accept them too. */
+    bool remoteUpdates;
+    /* Cached pages we have written to, these have an entry in twins. */
+    Bitmap *twinned;
+    Twin *twins;
+    size_t numberOfTwins;
+    /* Capacity of twins. */
+    size_t twinsSize;
 } Allocation;
 
+/* Header of a remote update in an active message, see ShrayAccumulate and
+ * ShrayPut. It is followed by the values, padded to a multiple of 8 bytes.
+ * For a put, n is the number of bytes. */
+typedef struct UpdateRecord {
+    uintptr_t address;
+    uint32_t n;
+    uint8_t type;
+    uint8_t op;
+} UpdateRecord;
+
+/* Start of a checkpoint file, see ShrayCheckpoint, and end of a file in the
+ * store, see ShrayStore. If hasSplitPoints, it is followed by ranks + 1 split
+ * points. The array is at dataOffset, in the byte order of the nodes that
+ * wrote it. */
+typedef struct CheckpointHeader {
+    char magic[8];
+    uint64_t version;
+    uint64_t dataOffset;
+    uint64_t firstDimension;
+    uint64_t size;
+    /* The distribution, see Distribution, and Shray_size when written. */
+    uint64_t ranks;
+    uint64_t hasSplitPoints;
+    uint64_t blockRows;
+    uint64_t columns;
+    uint64_t gridRows;
+    uint64_t gridCols;
+    uint64_t haloRows;
+    uint64_t replicated;
+    uint64_t maxStaleness;
+    uint64_t multiWriter;
+    uint64_t remoteUpdates;
+} CheckpointHeader;
+
+/* length bytes at memory that are stored at offset in a file, see
+ * ShrayReadFile and ShrayCheckpoint. */
+typedef struct FileSegment {
+    char *memory;
+    size_t length;
+    off_t offset;
+} FileSegment;
+
+/* Number of size classes of the heap, chunks of class k are Shray_Pagesz << k
+ * bytes. */
+#define SIZE_CLASSES 48
+
 typedef struct Heap {
     /* size of allocs */
     size_t size;
@@ -41,6 +220,17 @@ typedef struct Heap {
     Allocation *allocs;
     /* Number of actual allocations in the allocs */
     unsigned int numberOfAllocs;
+    /* Address space reserved by ShrayInit, at the same address on every node.
+     * Chunks in [reservedStart, top[ have been handed out, and are reused
+     * after ShrayFree. */
+    uintptr_t reservedStart;
+    uintptr_t reservedEnd;
+    uintptr_t top;
+    /* Per size class a stack of freed chunks. */
+    uintptr_t *freeChunks[SIZE_CLASSES];
+    size_t numberOfFreeChunks[SIZE_CLASSES];
+    /* Capacity of freeChunks. */
+    size_t freeChunksSize[SIZE_CLASSES];
 } Heap;
 
 /**************************************************
@@ -51,6 +241,8 @@ extern unsigned int Shray_rank;
 extern unsigned int Shray_size;
 extern size_t Shray_SegfaultCounter;
 extern size_t Shray_BarrierCounter;
+extern size_t Shray_FetchedBytes;
+extern size_t Shray_DeltaSavedBytes;
 extern size_t Shray_Pagesz;
 extern size_t Shray_CacheLineSize;
 extern double Shray_CacheAllocFactor;
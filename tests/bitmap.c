@@ -2,12 +2,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+static int failures = 0;
+
 #define TEST(function)                                        \
     {                                                       \
         if (function) {                                     \
             printf("%s was succesfull\n", #function);         \
         } else {                                            \
             printf("%s was unsuccesfull\n", #function);      \
+            failures++;                                     \
         }                                                   \
     }
 
@@ -28,32 +31,6 @@ void testPrint(void)
     BitmapFree(bitmap);
 }
 
-int testSurrounding(void)
-{
-    Bitmap *bitmap = BitmapCreate(190);
-    bitmap->bits[0] = 0x0FFFFFFFFFFFFFF8u;
-    bitmap->bits[1] = 0xFFFFFFFFFFFFFFFFu;
-    bitmap->bits[2] = 0xFFFFFFFFFFFFFFFFu;
-
-    /* Should be [4, 61[ for 3 < index < 61, and [64, 190[ index > 63. */
-    Range range1 = BitmapSurrounding(bitmap, 17);
-    Range range2 = BitmapSurrounding(bitmap, 100);
-    Range range3 = BitmapSurrounding(bitmap, 188);
-
-    bitmap->bits[0] = 0x8000000000000000u;
-    bitmap->bits[1] = 0xFFFFFFFFFFFFFFFFu;
-    bitmap->bits[2] = 0xFFFFFFFFFFFFFFFFu;
-
-    Range range4 = BitmapSurrounding(bitmap, 0);
-
-    BitmapFree(bitmap);
-
-    return (range1.start == 4 && range1.end == 61 &&
-            range2.start == 64 && range2.end == 190 &&
-            range3.start == 64 && range3.end == 190 &&
-            range4.start == 0 && range4.end == 1);
-}
-
 int testCheck(void)
 {
     /* Only has a one on position 70 and 0 */
@@ -103,12 +80,6 @@ void testSetting2(void)
     BitmapPrint(bitmap);
 }
 
-int testCount(void)
-{
-    uint64_t bla = 0xF0F0F0F0F0F0F0F0u;
-    return (countBitsLeft(bla, 8) == 1) && (countBitsRight(bla, 0) == 4);
-}
-
 int testStencil(void)
 {
     Bitmap *bitmap = BitmapCreate(100000);
@@ -140,16 +111,54 @@ int testReduce(void)
     return success;
 }
 
-int testReduce2(void)
+int testNextOne(void)
 {
-    Bitmap *bitmap = BitmapCreate(20);
-    BitmapSetOnes(bitmap, 10, 20);
-    printf("Should have ones [10, 20[\n");
-    BitmapPrint(bitmap);
+    /* Ones at both ends of every word, the last word is partial. */
+    Bitmap *bitmap = BitmapCreate(190);
+    BitmapSetOne(bitmap, 0);
+    BitmapSetOne(bitmap, 63);
+    BitmapSetOne(bitmap, 64);
+    BitmapSetOne(bitmap, 127);
+    BitmapSetOne(bitmap, 128);
+    BitmapSetOne(bitmap, 189);
+
+    int success = (BitmapNextOne(bitmap, 0) == 0 &&
+            BitmapNextOne(bitmap, 1) == 63 &&
+            BitmapNextOne(bitmap, 63) == 63 &&
+            BitmapNextOne(bitmap, 64) == 64 &&
+            BitmapNextOne(bitmap, 65) == 127 &&
+            BitmapNextOne(bitmap, 128) == 128 &&
+            BitmapNextOne(bitmap, 129) == 189 &&
+            BitmapNextOne(bitmap, 189) == 189 &&
+            BitmapNextOne(bitmap, 190) == 190 &&
+            BitmapNextOne(bitmap, 1000) == 190);
+
+    /* Bits past the end of the last word are not in the bitmap. */
+    bitmap->bits[2] = 0x0000000000000003u;
+    success = success && BitmapNextOne(bitmap, 129) == 190;
+
+    BitmapFree(bitmap);
+
+    Bitmap *empty = BitmapCreate(128);
+    success = success && BitmapNextOne(empty, 0) == 128 &&
+        BitmapNextOne(empty, 127) == 128;
+    BitmapFree(empty);
+
+    return success;
+}
+
+int testSetOnes(void)
+{
+    Bitmap *bitmap = BitmapCreate(190);
+    BitmapSetOnes(bitmap, 6, 179);
 
-    Range range = BitmapSurrounding(bitmap, 10);
+    int success = (BitmapNextOne(bitmap, 0) == 6 &&
+            BitmapCheck(bitmap, 178) && !BitmapCheck(bitmap, 179) &&
+            BitmapNextOne(bitmap, 179) == 190);
 
-    int success = (range.start == 10) && (range.end == 20);
+    BitmapSetOnes(bitmap, 64, 65);
+    BitmapSetZeroes(bitmap, 6, 179);
+    success = success && BitmapNextOne(bitmap, 0) == 190;
 
     BitmapFree(bitmap);
 
@@ -160,16 +169,15 @@ int main(void)
 {
     testPrint();
 
-    TEST(testSurrounding());
     TEST(testCheck());
-    TEST(testCount());
     TEST(testStencil());
     TEST(testReduce());
-    TEST(testReduce2());
+    TEST(testNextOne());
+    TEST(testSetOnes());
 
     testSetting();
 
     testSetting2();
 
-    return 0;
+    return failures != 0;
 }
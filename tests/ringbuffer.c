@@ -0,0 +1,139 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int failures = 0;
+
+#define TEST(function)                                        \
+    {                                                       \
+        if (function) {                                     \
+            printf("%s was succesfull\n", #function);         \
+        } else {                                            \
+            printf("%s was unsuccesfull\n", #function);      \
+            failures++;                                     \
+        }                                                   \
+    }
+
+#include "../src/ringbuffer.c"
+
+/* Entries store their number as start, so we can check the order. */
+static void *entry(uintptr_t number)
+{
+    return (void *)number;
+}
+
+int testAddWhenFull(void)
+{
+    ringbuffer_t *ring = ringbuffer_alloc(4);
+    int success = ringbuffer_empty(ring) && !ringbuffer_full(ring);
+
+    /* Like SegvHandler, evict the front once the ring is full. */
+    size_t evictions = 0;
+    for (uintptr_t i = 0; i < 20; i++) {
+        if (ringbuffer_full(ring)) {
+            success = success && ringbuffer_front(ring)->start == entry(i - 4);
+            evictions++;
+        }
+        ringbuffer_add(ring, NULL, entry(i));
+        success = success && ring->entries <= ring->size;
+    }
+
+    success = success && evictions == 16 && ring->entries == 4 &&
+        ringbuffer_full(ring) && ringbuffer_front(ring)->start == entry(16);
+
+    ringbuffer_free(ring);
+    return success;
+}
+
+/* Keeps the entries whose number is not divisible by *arg. */
+static int keepIndivisible(const cache_entry_t *entry, void *arg)
+{
+    return (uintptr_t)entry->start % *(uintptr_t *)arg != 0;
+}
+
+/* True if ring holds exactly the entries numbered numbers[0..n[, front first,
+ * checked by removing them. */
+static int holds(ringbuffer_t *ring, const uintptr_t *numbers, size_t n)
+{
+    int success = ring->entries == n;
+    for (size_t i = 0; i < n && success; i++) {
+        success = !ringbuffer_empty(ring) &&
+            ringbuffer_front(ring)->start == entry(numbers[i]);
+        ringbuffer_del(ring);
+    }
+    return success && ringbuffer_empty(ring);
+}
+
+int testFilterKeepsOrder(void)
+{
+    ringbuffer_t *ring = ringbuffer_alloc(8);
+    for (uintptr_t i = 1; i <= 6; i++) {
+        ringbuffer_add(ring, NULL, entry(i));
+    }
+
+    uintptr_t divisor = 2;
+    ringbuffer_filter(ring, keepIndivisible, &divisor);
+    uintptr_t expected[] = {1, 3, 5};
+    int success = holds(ring, expected, 3);
+
+    ringbuffer_free(ring);
+    return success;
+}
+
+int testFilterRemovesAll(void)
+{
+    ringbuffer_t *ring = ringbuffer_alloc(4);
+    for (uintptr_t i = 1; i <= 4; i++) {
+        ringbuffer_add(ring, NULL, entry(i));
+    }
+
+    uintptr_t divisor = 1;
+    ringbuffer_filter(ring, keepIndivisible, &divisor);
+    int success = ringbuffer_empty(ring) && ring->entries == 0;
+
+    /* The ring is usable again. */
+    ringbuffer_add(ring, NULL, entry(7));
+    uintptr_t expected[] = {7};
+    success = success && holds(ring, expected, 1);
+
+    /* Filtering an empty ring does nothing. */
+    ringbuffer_filter(ring, keepIndivisible, &divisor);
+    success = success && ringbuffer_empty(ring);
+
+    ringbuffer_free(ring);
+    return success;
+}
+
+int testFilterWrapAround(void)
+{
+    /* After 7 adds to a ring of 5, the entries 3..7 start at index 2 and
+     * wrap around the end of the array. */
+    ringbuffer_t *ring = ringbuffer_alloc(5);
+    for (uintptr_t i = 1; i <= 7; i++) {
+        ringbuffer_add(ring, NULL, entry(i));
+    }
+
+    uintptr_t divisor = 3;
+    ringbuffer_filter(ring, keepIndivisible, &divisor);
+    int success = !ringbuffer_full(ring);
+
+    /* New entries go after the kept ones, and the ring fills up again. */
+    ringbuffer_add(ring, NULL, entry(8));
+    ringbuffer_add(ring, NULL, entry(10));
+    success = success && ringbuffer_full(ring);
+    uintptr_t expected[] = {4, 5, 7, 8, 10};
+    success = success && holds(ring, expected, 5);
+
+    ringbuffer_free(ring);
+    return success;
+}
+
+int main(void)
+{
+    TEST(testAddWhenFull());
+    TEST(testFilterKeepsOrder());
+    TEST(testFilterRemovesAll());
+    TEST(testFilterWrapAround());
+
+    return failures != 0;
+}